@@ -29,9 +29,22 @@
 #define ACCOUNT_H
 
 #include <stdlib.h>
+#include <stdio.h>
+
+#include <xmem_types.h>
 
 void acc_set_reentrant(void);
+int acc_set_shards(int n);
+void acc_reserve(size_t n);
+void acc_set_lazy_text(void);
+int acc_enable_headers(void);
+int acc_set_sampling(size_t rate);
+int acc_enable_address_index(void);
 int acc_enable_memlog(void);
+int acc_enable_memlog_to(const char *path);
+int acc_enable_binlog(const char *path);
+int acc_enable_stacks(void);
+int acc_set_stack_depth(int depth);
 
 void *acc_malloc(size_t sz, char *file, int line, char txt[], ...)
         __attribute__ (( format(printf, 4, 5) ));
@@ -43,9 +56,77 @@ char *acc_strndup(const char *str, size_t sz, char *file, int line);
 
 char *acc_character(const void *ptr);
 
+int acc_site_stats(int (*callback)(const struct xmem_site_stats *stats,
+            void *arg), void *arg);
+
+void acc_stats_snapshot(struct xmem_stats *stats);
+void acc_reset_peak(void);
+
+int acc_enable_site_histograms(void);
+void acc_report_histograms_at_exit(void);
+void acc_size_histogram(struct xmem_histogram *hist);
+void acc_dump_histograms(FILE *out);
+
+int acc_stack_stats(int (*callback)(const struct xmem_stack_stats *stats,
+            void *arg), void *arg);
+void acc_print_stack(FILE *out, unsigned id);
+
+int acc_profile_report(FILE *out);
+void acc_report_profile_at_exit(void);
+
+void acc_group_leaks(int top);
+
+/**
+ * Marks start a new generation of blocks; acc_report_since() reports those
+ * still allocated from a mark on, the first mark being 1.
+ */
+unsigned acc_mark(void);
+int acc_report_since(unsigned mark);
+
+int acc_dump_heap(const char *path);
+int acc_dump_on_signal(int sig, const char *path);
+
 void acc_check(const void *ptr, const void *base, char file[], int line);
 void acc_checkr(const void *ptr, size_t sz, const void *base,
         char file[], int line);
 
+void *acc_find_block(const void *ptr, char file[], int line);
+void acc_check_any(const void *ptr, char file[], int line);
+void acc_checkr_any(const void *ptr, size_t sz, char file[], int line);
+
+/**
+ * A base resolved once, to check against many times without going back to
+ * the storage. It goes stale if the block is freed or reallocated.
+ */
+typedef struct {
+    const char *base;
+    size_t sz;
+
+} xmem_bounds_t;
+
+xmem_bounds_t acc_pin(const void *base, char file[], int line);
+void acc_check_pinned_fail(const void *ptr, xmem_bounds_t b, char file[],
+        int line) __attribute__ (( noreturn, cold ));
+void acc_checkr_pinned_fail(const void *ptr, size_t sz, xmem_bounds_t b,
+        char file[], int line) __attribute__ (( noreturn, cold ));
+
+static inline void
+acc_check_pinned(const void *ptr, xmem_bounds_t b, char file[], int line) {
+    if ((size_t)((const char *)ptr - b.base) >= b.sz)
+        acc_check_pinned_fail(ptr, b, file, line);
+
+}
+
+static inline void
+acc_checkr_pinned(const void *ptr, size_t sz, xmem_bounds_t b,
+        char file[], int line)
+{
+    size_t off = (const char *)ptr - b.base;
+
+    if (off >= b.sz || sz > b.sz - off)
+        acc_checkr_pinned_fail(ptr, sz, b, file, line);
+
+}
+
 #endif
 
@@ -32,6 +32,8 @@
 #warning ENABLE_LIBXMEM not explicitely defined -- defaulting to disabled
 #endif
 
+#include <xmem_types.h>
+
 #if ENABLE_LIBXMEM
 
 #include <account.h>
@@ -44,12 +46,47 @@
 #define xstrndup(str, sz) acc_strndup((str), (sz), __FILE__, __LINE__)
 
 #define character(ptr) acc_character(ptr)
+#define xmem_site_stats(callback, arg) acc_site_stats(callback, arg)
+#define xmem_stats_snapshot(stats) acc_stats_snapshot(stats)
+#define xmem_reset_peak() acc_reset_peak()
+#define xmem_enable_site_histograms() acc_enable_site_histograms()
+#define xmem_report_histograms_at_exit() acc_report_histograms_at_exit()
+#define xmem_size_histogram(hist) acc_size_histogram(hist)
+#define xmem_dump_histograms(out) acc_dump_histograms(out)
+#define xmem_profile_report(out) acc_profile_report(out)
+#define xmem_report_profile_at_exit() acc_report_profile_at_exit()
+#define xmem_group_leaks(top) acc_group_leaks(top)
+#define xmem_mark() acc_mark()
+#define xmem_report_since(mark) acc_report_since(mark)
+#define xmem_dump_heap(path) acc_dump_heap(path)
+#define xmem_dump_on_signal(sig, path) acc_dump_on_signal(sig, path)
 #define xmem_set_reentrant() acc_set_reentrant()
+#define xmem_set_shards(n) acc_set_shards(n)
+#define xmem_reserve(n) acc_reserve(n)
+#define xmem_set_lazy_text() acc_set_lazy_text()
+#define xmem_enable_headers() acc_enable_headers()
+#define xmem_set_sampling(rate) acc_set_sampling(rate)
+#define xmem_enable_address_index() acc_enable_address_index()
 #define xmem_enable_memlog() acc_enable_memlog()
+#define xmem_enable_memlog_to(path) acc_enable_memlog_to(path)
+#define xmem_enable_binlog(path) acc_enable_binlog(path)
+#define xmem_enable_stacks() acc_enable_stacks()
+#define xmem_set_stack_depth(depth) acc_set_stack_depth(depth)
+#define xmem_stack_stats(callback, arg) acc_stack_stats(callback, arg)
+#define xmem_print_stack(out, id) acc_print_stack(out, id)
 
 #define check(ptr, base) acc_check(ptr, base, __FILE__, __LINE__)
 #define checkr(ptr, sz, base) acc_checkr(ptr, sz, base, __FILE__, __LINE__)
 
+#define xmem_find_block(ptr) acc_find_block(ptr, __FILE__, __LINE__)
+#define check_any(ptr) acc_check_any(ptr, __FILE__, __LINE__)
+#define checkr_any(ptr, sz) acc_checkr_any(ptr, sz, __FILE__, __LINE__)
+
+#define xmem_pin(base) acc_pin(base, __FILE__, __LINE__)
+#define check_pinned(ptr, b) acc_check_pinned(ptr, b, __FILE__, __LINE__)
+#define checkr_pinned(ptr, sz, b) \
+    acc_checkr_pinned(ptr, sz, b, __FILE__, __LINE__)
+
 #else
 
 #define xmalloc(sz, ...) malloc(sz)
@@ -60,11 +97,48 @@
 #define xstrndup strndup
 
 #define xmem_set_reentrant()
+#define xmem_set_shards(n) 0
+#define xmem_reserve(n)
+#define xmem_set_lazy_text()
+#define xmem_enable_headers() 0
+#define xmem_set_sampling(rate) 0
+#define xmem_enable_address_index() 0
 #define xmem_enable_memlog()
+#define xmem_enable_memlog_to(path) 0
+#define xmem_enable_binlog(path) 0
+#define xmem_enable_stacks() 0
+#define xmem_set_stack_depth(depth) 0
+
+#define xmem_site_stats(callback, arg) 0
+#define xmem_stats_snapshot(stats)
+#define xmem_reset_peak()
+#define xmem_stack_stats(callback, arg) 0
+#define xmem_print_stack(out, id)
+#define xmem_enable_site_histograms() 0
+#define xmem_report_histograms_at_exit()
+#define xmem_size_histogram(hist)
+#define xmem_dump_histograms(out)
+#define xmem_profile_report(out) 0
+#define xmem_report_profile_at_exit()
+#define xmem_group_leaks(top)
+#define xmem_mark() 0
+#define xmem_report_since(mark) 0
+#define xmem_dump_heap(path) 0
+#define xmem_dump_on_signal(sig, path) 0
 
 #define check(ptr, base)
 #define checkr(ptr, sz, base)
 
+#define xmem_find_block(ptr) NULL
+#define check_any(ptr)
+#define checkr_any(ptr, sz)
+
+typedef int xmem_bounds_t;
+
+#define xmem_pin(base) 0
+#define check_pinned(ptr, b) ((void)(b))
+#define checkr_pinned(ptr, sz, b) ((void)(b))
+
 #endif
 
 #endif
@@ -0,0 +1,97 @@
+/**
+ * Copyright (c) 2014-2021, Ignacio Nin <nachex@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if !defined(XMEM_TYPES_H)
+#define XMEM_TYPES_H
+
+/*
+ * Types handed out by the statistics interfaces. They're kept apart from
+ * account.h so that code using them still compiles with libxmem disabled.
+ */
+
+#include <stddef.h>
+
+/**
+ * Allocation counts by size class. Class 0 holds sizes 0 and 1, and class n
+ * sizes from 2^(n-1) + 1 to 2^n; the last class also takes anything larger.
+ */
+#define XMEM_SIZE_CLASSES 64
+
+struct xmem_histogram {
+    unsigned long allocs[XMEM_SIZE_CLASSES];
+    unsigned long live[XMEM_SIZE_CLASSES];
+
+};
+
+/**
+ * What's been allocated at one site (file and line) so far. Operations made
+ * by other threads very recently may not be counted yet.
+ */
+struct xmem_site_stats {
+    const char *file;
+    int line;
+
+    unsigned long allocs;
+    unsigned long frees;
+    unsigned long live_blocks;
+    size_t live_bytes;
+    size_t peak_bytes;
+    size_t total_bytes;
+
+    // Only with acc_enable_site_histograms()
+    const struct xmem_histogram *histogram;
+
+};
+
+/**
+ * Totals for the whole process. A reallocation counts as one free and one
+ * allocation.
+ */
+struct xmem_stats {
+    size_t live_bytes;
+    unsigned long live_blocks;
+    size_t peak_bytes;
+    unsigned long allocs;
+    unsigned long frees;
+
+};
+
+/**
+ * What's still allocated from one call stack, as captured with
+ * acc_enable_stacks(). Frames are return addresses, innermost first.
+ */
+struct xmem_stack_stats {
+    unsigned id;
+    int depth;
+    void *const *frames;
+
+    unsigned long blocks;
+    size_t bytes;
+
+};
+
+#endif
@@ -97,10 +97,46 @@ AC_DEFUN([LIBXMEM_DEFINE_STUBS], [
     AC_DEFINE([xstrndup], [strndup], [Defined by libxmem.m4])
 
     AC_DEFINE([xmem_set_reentrant()], [], [Defined by libxmem.m4])
+    AC_DEFINE([xmem_set_shards(n)], [0], [Defined by libxmem.m4])
+    AC_DEFINE([xmem_reserve(n)], [], [Defined by libxmem.m4])
+    AC_DEFINE([xmem_set_lazy_text()], [], [Defined by libxmem.m4])
+    AC_DEFINE([xmem_enable_headers()], [0], [Defined by libxmem.m4])
+    AC_DEFINE([xmem_set_sampling(rate)], [0], [Defined by libxmem.m4])
+    AC_DEFINE([xmem_enable_address_index()], [0], [Defined by libxmem.m4])
     AC_DEFINE([xmem_enable_memlog()], [], [Defined by libxmem.m4])
+    AC_DEFINE([xmem_enable_memlog_to(path)], [0], [Defined by libxmem.m4])
+    AC_DEFINE([xmem_enable_binlog(path)], [0], [Defined by libxmem.m4])
+    AC_DEFINE([xmem_enable_stacks()], [0], [Defined by libxmem.m4])
+    AC_DEFINE([xmem_set_stack_depth(depth)], [0], [Defined by libxmem.m4])
+    AC_DEFINE([xmem_site_stats(callback, arg)], [0], [Defined by libxmem.m4])
+    AC_DEFINE([xmem_stats_snapshot(stats)], [], [Defined by libxmem.m4])
+    AC_DEFINE([xmem_reset_peak()], [], [Defined by libxmem.m4])
+    AC_DEFINE([xmem_stack_stats(callback, arg)], [0], [Defined by libxmem.m4])
+    AC_DEFINE([xmem_print_stack(out, id)], [], [Defined by libxmem.m4])
+    AC_DEFINE([xmem_enable_site_histograms()], [0], [Defined by libxmem.m4])
+    AC_DEFINE([xmem_report_histograms_at_exit()], [],
+        [Defined by libxmem.m4])
+    AC_DEFINE([xmem_size_histogram(hist)], [], [Defined by libxmem.m4])
+    AC_DEFINE([xmem_dump_histograms(out)], [], [Defined by libxmem.m4])
+    AC_DEFINE([xmem_profile_report(out)], [0], [Defined by libxmem.m4])
+    AC_DEFINE([xmem_report_profile_at_exit()], [], [Defined by libxmem.m4])
+    AC_DEFINE([xmem_group_leaks(top)], [], [Defined by libxmem.m4])
+    AC_DEFINE([xmem_mark()], [0], [Defined by libxmem.m4])
+    AC_DEFINE([xmem_report_since(mark)], [0], [Defined by libxmem.m4])
+    AC_DEFINE([xmem_dump_heap(path)], [0], [Defined by libxmem.m4])
+    AC_DEFINE([xmem_dump_on_signal(sig, path)], [0], [Defined by libxmem.m4])
 
     AC_DEFINE([check(ptr, base)], [], [Defined by libxmem.m4])
     AC_DEFINE([checkr(ptr, sz, base)], [], [Defined by libxmem.m4])
+    AC_DEFINE([xmem_find_block(ptr)], [NULL], [Defined by libxmem.m4])
+    AC_DEFINE([check_any(ptr)], [], [Defined by libxmem.m4])
+    AC_DEFINE([checkr_any(ptr, sz)], [], [Defined by libxmem.m4])
+
+    AC_DEFINE([xmem_bounds_t], [int], [Defined by libxmem.m4])
+    AC_DEFINE([xmem_pin(base)], [0], [Defined by libxmem.m4])
+    AC_DEFINE([check_pinned(ptr, b)], [((void)(b))], [Defined by libxmem.m4])
+    AC_DEFINE([checkr_pinned(ptr, sz, b)], [((void)(b))],
+              [Defined by libxmem.m4])
   ])
 ])
 
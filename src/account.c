@@ -28,12 +28,44 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
 
 #include <config.h>
 
+#include "binlog.h"
+#include "depot.h"
+#include "dump.h"
+#include "format.h"
+#include "header.h"
+#include "options.h"
+#include "preload.h"
+#include "profile.h"
+#include "report.h"
+#include "sample.h"
+#include "site.h"
+#include "stats.h"
 #include "store.h"
 
 FILE *memory_log;
+int hd_enabled;
+int exit_histograms;
+int exit_profile;
+int group_leaks;
+int group_top;
+
+#define ACC_REPORT_BUFFER (64 * 1024)
+
+// How long a heap dump may take, and how often the wait for it wakes up, in
+// milliseconds
+#define ACC_DUMP_TIMEOUT (60 * 1000)
+#define ACC_DUMP_SLICE 100
 
 int acc_init(void) __attribute__ ((constructor));
 void acc_finalize(void);
@@ -41,6 +73,7 @@ void acc_finalize(void);
 int
 acc_init(void) {
     atexit(acc_finalize);
+    op_init();
 
     return 0;
 
@@ -52,75 +85,466 @@ acc_set_reentrant() {
 
 }
 
+int
+acc_set_shards(int n) {
+    return as_set_shards(n);
+
+}
+
+void
+acc_reserve(size_t n) {
+    as_reserve(n);
+
+}
+
+void
+acc_set_lazy_text() {
+    as_set_lazy();
+
+}
+
+int
+acc_enable_headers() {
+    // Blocks allocated before this point would have no header
+    if (!hd_enabled && !as_pristine())
+        return 0;
+
+    hd_enabled = 1;
+
+    return 1;
+
+}
+
+int
+acc_set_sampling(size_t rate) {
+    // Unsampled blocks are told apart by their header
+    if (!rate || (!sm_rate && !as_pristine()))
+        return 0;
+
+    hd_enabled = 1;
+    sm_set_rate(rate);
+    as_set_weighted();
+
+    return 1;
+
+}
+
+int
+acc_enable_stacks() {
+    dp_enable();
+
+    return 1;
+
+}
+
+int
+acc_set_stack_depth(int depth) {
+    return dp_set_depth(depth);
+
+}
+
+int
+acc_enable_address_index() {
+    return as_enable_addr_index();
+
+}
+
 int
 acc_enable_memlog() {
+    return acc_enable_memlog_to("memory.log");
+
+}
+
+int
+acc_enable_memlog_to(const char *path) {
     if (!memory_log)
-        memory_log = fopen("memory.log", "w");
+        memory_log = fopen(path, "w");
         // Ignore any errors, we'd have to abort
 
     return memory_log != 0;
 
 }
 
-static int
-acc_print_block(void *ptr, size_t sz, char txt[],
-        char *file, int line, void *arg)
-{
-    fprintf(stderr, "- %lu bytes allocated in %s, line %d: txt `%s'\n",
-            sz, file, line, txt);
+int
+acc_enable_binlog(const char *path) {
+    return bl_open(path);
 
-    return 0;
+}
+
+/**
+ * Reports go through a stream of their own, fully buffered: stderr writes
+ * each line as it comes, which takes long with many blocks to report.
+ */
+static FILE *
+acc_report_stream(void) {
+    FILE *out;
+    int fd;
+
+    fd = dup(fileno(stderr));
+    if (fd < 0)
+        return stderr;
+
+    out = fdopen(fd, "w");
+    if (!out) {
+        close(fd);
+        return stderr;
+    }
+    setvbuf(out, NULL, _IOFBF, ACC_REPORT_BUFFER);
+
+    return out;
+
+}
+
+static void
+acc_report_blocks(FILE *out, uint32_t since) {
+    if (group_leaks)
+        rp_grouped(out, group_top, since);
+    else
+        rp_blocks(out, since);
+
+}
+
+static void
+acc_report(void) {
+    FILE *out;
+    int count;
+
+    bl_close();
+    if (memory_log) {
+        FILE *log = memory_log;
+
+        // Blocks may still be freed after this
+        memory_log = NULL;
+        fclose(log);
+    }
+
+    out = acc_report_stream();
+
+    if (exit_histograms)
+        si_dump(out);
+    if (exit_profile)
+        pf_report(out);
+
+    count = as_count();
+    if (!count) {
+        if (out != stderr)
+            fclose(out);
+        return;
+    }
+
+    if (sm_rate) {
+        struct xmem_stats stats;
+
+        st_snapshot(&stats);
+        fprintf(out, "%d sampled %s on termination, about %lu blocks "
+                "and %lu bytes in all:\n", count,
+                count == 1 ? "block exists" : "blocks exist",
+                stats.live_blocks, (unsigned long)stats.live_bytes);
+    }
+    else
+        fprintf(out, "%d allocated %s on termination:\n", count,
+                count == 1 ? "block exists" : "blocks exist");
+
+    acc_report_blocks(out, 0);
+
+    if (out != stderr)
+        fclose(out);
 
 }
 
 void
 acc_finalize(void) {
-    if (!as_count())
-        return;
+    // Reporting allocates, which mustn't be accounted with the preload library
+    pl_busy ++;
+    acc_report();
+    pl_busy --;
 
-    if (memory_log)
-        fclose(memory_log);
+}
 
-    fprintf(stderr, "%d allocated %s on termination:\n", as_count(),
-            as_count() == 1 ? "block exists" : "blocks exist");
-    as_walk(acc_print_block, NULL);
+unsigned
+acc_mark(void) {
+    return as_mark();
 
 }
 
-void *
-acc_malloc(size_t sz, char *file, int line, char txt[], ...) {
-    va_list va;
-    void *ret;
-    va_list vacopy;
+/**
+ * Like the exit report, but only for blocks allocated since the mark, and
+ * while the program goes on.
+ */
+int
+acc_report_since(unsigned mark) {
+    FILE *out;
+    int count;
 
-    ret = malloc(sz);
-    if (!ret)
+    pl_busy ++;
+
+    count = rp_count(mark);
+    if (count) {
+        out = acc_report_stream();
+
+        fprintf(out, "%d %s allocated since mark %u still %s:\n", count,
+                count == 1 ? "block" : "blocks", mark,
+                count == 1 ? "exists" : "exist");
+        acc_report_blocks(out, mark);
+
+        if (out != stderr)
+            fclose(out);
+    }
+
+    pl_busy --;
+
+    return count;
+
+}
+
+/**
+ * Writes the dump under a temporary name, renamed once complete, so the file
+ * at path is always a whole dump. This runs in a child forked off a threaded
+ * process, so only async-signal-safe calls are made.
+ */
+static int
+acc_write_dump(const char *path) {
+    char tmp[PATH_MAX];
+    size_t len;
+    int fd, ok;
+
+    len = strlen(path);
+    if (len + 1 + FM_ULONGDIGITS >= sizeof(tmp))
+        return 0;
+    memcpy(tmp, path, len);
+    tmp[len ++] = '.';
+    len += fm_ulong(tmp + len, getpid());
+    tmp[len] = '\0';
+
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return 0;
+
+    ok = rp_dump(fd, getppid());
+    if (close(fd) || !ok || rename(tmp, path)) {
+        unlink(tmp);
+        return 0;
+    }
+
+    return 1;
+
+}
+
+/**
+ * The dump is written by a child process, from its copy of the store, so
+ * threads only stop for as long as forking takes however large the store
+ * is. The child tells how it went through a pipe rather than its exit
+ * status, which is lost if it's reaped elsewhere (e.g. with SIGCHLD
+ * ignored), and is killed if it takes too long.
+ */
+int
+acc_dump_heap(const char *path) {
+    struct pollfd pfd;
+    int fds[2], status, waited, r = 0;
+    char done = 0;
+    pid_t pid;
+
+    if (pipe(fds))
+        return 0;
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+    pl_busy ++;
+
+    pid = as_fork();
+    if (!pid) {
+        close(fds[0]);
+        done = acc_write_dump(path);
+        _exit(write(fds[1], &done, 1) != 1 || !done);
+    }
+    close(fds[1]);
+
+    if (pid > 0) {
+        pfd.fd = fds[0];
+        pfd.events = POLLIN;
+        for (waited = 0; waited < ACC_DUMP_TIMEOUT; waited += ACC_DUMP_SLICE)
+            if ((r = poll(&pfd, 1, ACC_DUMP_SLICE)) > 0 ||
+                    (r < 0 && errno != EINTR))
+                break;
+
+        if (r <= 0 || read(fds[0], &done, 1) != 1) {
+            done = 0;
+            kill(pid, SIGKILL);
+        }
+
+        // ECHILD if it was reaped elsewhere, which is fine
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+            ;
+    }
+    close(fds[0]);
+
+    pl_busy --;
+
+    return done;
+
+}
+
+int
+acc_dump_on_signal(int sig, const char *path) {
+    return du_on_signal(sig, path);
+
+}
+
+/**
+ * The libc calls proper, which in header mode allocate room for the header
+ * and fill it in.
+ */
+static void *
+acc_raw_malloc(size_t sz) {
+    void *raw;
+
+    if (!hd_enabled)
+        return malloc(sz);
+
+    if (sz > (size_t)-1 - HD_SIZE)
         return NULL;
 
-    va_start(va, txt);
+    raw = malloc(HD_SIZE + sz);
+    if (!raw)
+        return NULL;
+
+    return hd_init(raw, sz);
+
+}
+
+static void *
+acc_raw_realloc(void *ptr, size_t sz) {
+    void *raw;
+
+    if (!hd_enabled)
+        return realloc(ptr, sz);
+
+    if (!ptr)
+        return acc_raw_malloc(sz);
+
+    if (sz > (size_t)-1 - HD_SIZE)
+        return NULL;
+
+    raw = realloc(hd_raw(ptr), HD_SIZE + sz);
+    if (!raw)
+        return NULL;
+
+    return hd_init(raw, sz);
+
+}
+
+/**
+ * Returns the weight of a new block, which is 0 if sampling leaves it out
+ * of the store; its header then says so.
+ */
+static unsigned long
+acc_sample(void *ptr, size_t sz) {
+    unsigned long weight;
+
+    if (!sm_rate)
+        return 1;
+
+    weight = sm_sample(sz);
+    if (!weight)
+        hd_get(ptr)->magic = HD_UNSAMPLED;
+
+    return weight;
+
+}
+
+static void
+acc_raw_free(void *ptr) {
+    if (!hd_enabled) {
+        free(ptr);
+        return;
+    }
+
+    hd_get(ptr)->magic = HD_FREED;
+    free(hd_raw(ptr));
+
+}
+
+/**
+ * The allocation stack of a block of the given weight, captured by the
+ * function the program called, so the depot knows how many frames to leave
+ * out.
+ */
+#define acc_stack(weight) ((weight) && dp_enabled ? dp_capture() : 0)
+
+/**
+ * Logs a new block and, unless it wasn't sampled, stores it.
+ */
+static void
+acc_vadd(void *ptr, size_t sz, unsigned long weight, uint32_t stack,
+        char *file, int line, char txt[], va_list va)
+{
+    va_list vacopy;
 
     if (memory_log) {
+        flockfile(memory_log);
         fprintf(memory_log, "%p: allocated %lu bytes at %s line %d: ",
-                ret, sz, file, line);
+                ptr, sz, file, line);
         va_copy(vacopy, va);
         vfprintf(memory_log, txt, vacopy);
         va_end(vacopy);
         fprintf(memory_log, "\n");
+        funlockfile(memory_log);
     }
+    if (bl_enabled)
+        bl_log(BL_MALLOC, ptr, NULL, sz, file, line);
+
+    if (weight)
+        as_vadd(ptr, sz, weight, stack, file, line, txt, va);
+
+}
+
+void *
+acc_malloc(size_t sz, char *file, int line, char txt[], ...) {
+    va_list va;
+    void *ret;
+    unsigned long weight;
+    PF_BEGIN(t);
 
-    as_vadd(ret, sz, file, line, txt, va);
+    PF_LIBC(t, ret = acc_raw_malloc(sz));
+    if (!ret)
+        return NULL;
+
+    weight = acc_sample(ret, sz);
+    va_start(va, txt);
+    acc_vadd(ret, sz, weight, acc_stack(weight), file, line, txt, va);
     va_end(va);
+    PF_END(t, PF_MALLOC);
 
     return ret;
 
 }
 
+void
+acc_track(void *ptr, size_t sz, char *file, int line, char txt[], ...) {
+    va_list va;
+
+    // No header to mark it unsampled, so it's always counted
+    va_start(va, txt);
+    acc_vadd(ptr, sz, 1, acc_stack(1), file, line, txt, va);
+    va_end(va);
+
+}
+
 void
 acc_free(void *ptr, char *file, int line) {
+    int unsampled;
+    PF_BEGIN(t);
+
+    // Not in the store, and not worth clearing when sampling for speed
+    unsampled = hd_unsampled(ptr);
+
     do {
         size_t oldsz;
 
-        if (!as_get(ptr, &oldsz))
+        if (unsampled)
+            break;
+
+        if (!hd_lookup(ptr, &oldsz))
             break;
 
         memset(ptr, 0, oldsz);
@@ -130,12 +554,15 @@ acc_free(void *ptr, char *file, int line) {
 
     if (memory_log)
         fprintf(memory_log, "%p: freed from %s line %d\n", ptr, file, line);
+    if (bl_enabled)
+        bl_log(BL_FREE, ptr, NULL, 0, file, line);
     
-    if (!as_delete(ptr)) {
+    if (!unsampled && !as_delete(ptr)) {
         printf("Aborting trying to delete %p, %s line %d\n", ptr, file, line);
         abort();
     }
-    free(ptr);
+    PF_LIBC(t, acc_raw_free(ptr));
+    PF_END(t, PF_FREE);
 
 }
 
@@ -143,30 +570,48 @@ void *
 acc_realloc(void *ptr, size_t sz, char *file, int line) {
     void *ret;
     size_t oldsz;
+    unsigned long weight;
+    int unsampled;
 
     if (!sz) {
         acc_free(ptr, file, line);
         return NULL;
     }
 
-    if (ptr && !as_get(ptr, &oldsz)) {
+    PF_BEGIN(t);
+
+    if (ptr && !hd_lookup(ptr, &oldsz)) {
         printf("Aborting trying to realloc %p, %s line %d; not found in "
                 "storage\n", ptr, file, line);
         abort();
     }
 
-    ret = realloc(ptr, sz);
+    unsampled = hd_unsampled(ptr);
+
+    PF_LIBC(t, ret = acc_raw_realloc(ptr, sz));
     if (!ret)
         return NULL;
 
-    if (ptr)
-        as_replace(ptr, ret, sz, file, line);
-    else
-        as_add(ret, sz, file, line, "realloced from NULL memory");
+    // Sampled anew, as if it were a new block
+    weight = acc_sample(ret, sz);
+    if (ptr && !unsampled) {
+        if (weight)
+            as_replace(ptr, ret, sz, weight, acc_stack(weight), file,
+                    line);
+        else
+            as_delete(ptr);
+    }
+    else if (weight)
+        as_add(ret, sz, weight, acc_stack(weight), file, line, ptr ?
+                "realloced from unsampled memory" :
+                "realloced from NULL memory");
 
     if (memory_log)
-        fprintf(memory_log, "%p: reallocated %p to %lu bytes at %s line %d",
+        fprintf(memory_log, "%p: reallocated %p to %lu bytes at %s line %d\n",
                 ret, ptr, sz, file, line);
+    if (bl_enabled)
+        bl_log(BL_REALLOC, ret, ptr, sz, file, line);
+    PF_END(t, PF_REALLOC);
 
     return ret;
 
@@ -175,16 +620,26 @@ acc_realloc(void *ptr, size_t sz, char *file, int line) {
 char *
 acc_strdup(const char *str, char *file, int line) {
     char *ret;
+    size_t len;
+    unsigned long weight;
+    PF_BEGIN(t);
 
-    ret = strdup(str);
+    PF_LIBC(t, len = strlen(str) + 1);
+    PF_LIBC(t, ret = acc_raw_malloc(len));
     if (!ret)
         return NULL;
+    PF_LIBC(t, memcpy(ret, str, len));
 
     if (memory_log)
-        fprintf(memory_log, "%p: strduped %lu bytes at %s line %d: ",
-                ret, strlen(str) + 1, file, line);
+        fprintf(memory_log, "%p: strduped %lu bytes at %s line %d: %s\n",
+                ret, len, file, line, ret);
+    if (bl_enabled)
+        bl_log(BL_STRDUP, ret, NULL, len, file, line);
     
-    as_add(ret, strlen(str) + 1, file, line, "%s", str);
+    weight = acc_sample(ret, len);
+    if (weight)
+        as_add(ret, len, weight, acc_stack(weight), file, line, "%s", str);
+    PF_END(t, PF_STRDUP);
 
     return ret;
 
@@ -193,16 +648,28 @@ acc_strdup(const char *str, char *file, int line) {
 char *
 acc_strndup(const char *str, size_t sz, char *file, int line) {
     char *ret;
+    size_t len;
+    unsigned long weight;
+    PF_BEGIN(t);
 
-    ret = strndup(str, sz);
+    PF_LIBC(t, len = strnlen(str, sz));
+    PF_LIBC(t, ret = acc_raw_malloc(len + 1));
     if (!ret)
         return NULL;
+    PF_LIBC(t, memcpy(ret, str, len));
+    ret[len] = '\0';
 
     if (memory_log)
-        fprintf(memory_log, "%p: strnduped %lu bytes at %s line %d: ",
-                ret, sz, file, line);
+        fprintf(memory_log, "%p: strnduped %lu bytes at %s line %d: %s\n",
+                ret, len + 1, file, line, ret);
+    if (bl_enabled)
+        bl_log(BL_STRNDUP, ret, NULL, len + 1, file, line);
     
-    as_add(ret, strlen(str) + 1, file, line, "%s", ret);
+    weight = acc_sample(ret, len + 1);
+    if (weight)
+        as_add(ret, len + 1, weight, acc_stack(weight), file, line, "%s",
+                ret);
+    PF_END(t, PF_STRDUP);
 
     return ret;
 
@@ -213,3 +680,80 @@ acc_character(const void *ptr) {
     return as_character(ptr);
 
 }
+
+int
+acc_site_stats(int (*callback)(const struct xmem_site_stats *stats,
+            void *arg), void *arg)
+{
+    return si_walk(callback, arg);
+
+}
+
+int
+acc_stack_stats(int (*callback)(const struct xmem_stack_stats *stats,
+            void *arg), void *arg)
+{
+    return rp_stack_stats(callback, arg, 0);
+
+}
+
+void
+acc_print_stack(FILE *out, unsigned id) {
+    dp_print(out, id, "    ");
+
+}
+
+void
+acc_stats_snapshot(struct xmem_stats *stats) {
+    st_snapshot(stats);
+
+}
+
+void
+acc_reset_peak(void) {
+    st_reset_peak();
+
+}
+
+int
+acc_enable_site_histograms() {
+    return si_enable_sizes();
+
+}
+
+void
+acc_report_histograms_at_exit() {
+    exit_histograms = 1;
+
+}
+
+void
+acc_size_histogram(struct xmem_histogram *hist) {
+    si_histogram(hist);
+
+}
+
+void
+acc_dump_histograms(FILE *out) {
+    si_dump(out);
+
+}
+
+int
+acc_profile_report(FILE *out) {
+    return pf_report(out);
+
+}
+
+void
+acc_group_leaks(int top) {
+    group_leaks = 1;
+    group_top = top > 0 ? top : 0;
+
+}
+
+void
+acc_report_profile_at_exit() {
+    exit_profile = 1;
+
+}
@@ -0,0 +1,260 @@
+/**
+ * Copyright (c) 2014-2021, Ignacio Nin <nachex@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <config.h>
+
+#include "addr.h"
+
+#include <stdlib.h>
+
+#include <pthread.h>
+
+#include "profile.h"
+#include "slab.h"
+
+/**
+ * Live blocks ordered by address, so that the block containing an arbitrary
+ * pointer can be found: it's the one with the highest start not above the
+ * pointer, if the pointer falls short of its end.
+ *
+ * This is a plain AVL tree. It's one for the whole process (the store's
+ * shards are split by hash, which says nothing about order), behind a
+ * reader/writer lock.
+ */
+
+struct node {
+    const char *start;
+    size_t sz;
+
+    struct node *left;
+    struct node *right;
+    int height;
+
+};
+
+struct node *root;
+struct slab nodes = SLAB_INITIALIZER(struct node);
+
+int ad_reentrant;
+pthread_rwlock_t addr_lk = PTHREAD_RWLOCK_INITIALIZER;
+
+#define LOCK() \
+    do { \
+        if (ad_reentrant) \
+            PF_LOCK(pthread_rwlock_trywrlock(&addr_lk), \
+                    pthread_rwlock_wrlock(&addr_lk)); \
+    } while(0)
+#define RDLOCK() \
+    do { \
+        if (ad_reentrant) \
+            PF_LOCK(pthread_rwlock_tryrdlock(&addr_lk), \
+                    pthread_rwlock_rdlock(&addr_lk)); \
+    } while(0)
+#define UNLOCK() \
+    do { \
+        if (ad_reentrant) \
+            pthread_rwlock_unlock(&addr_lk); \
+    } while(0)
+
+void
+ad_set_reentrant(void) {
+    ad_reentrant = 1;
+
+}
+
+static int
+ad_height(const struct node *n) {
+    return n ? n->height : 0;
+
+}
+
+static void
+ad_update(struct node *n) {
+    int l = ad_height(n->left), r = ad_height(n->right);
+
+    n->height = (l > r ? l : r) + 1;
+
+}
+
+static struct node *
+ad_rotate_right(struct node *n) {
+    struct node *l = n->left;
+
+    n->left = l->right;
+    l->right = n;
+    ad_update(n);
+    ad_update(l);
+
+    return l;
+
+}
+
+static struct node *
+ad_rotate_left(struct node *n) {
+    struct node *r = n->right;
+
+    n->right = r->left;
+    r->left = n;
+    ad_update(n);
+    ad_update(r);
+
+    return r;
+
+}
+
+static struct node *
+ad_balance(struct node *n) {
+    int bal;
+
+    ad_update(n);
+    bal = ad_height(n->left) - ad_height(n->right);
+
+    if (bal > 1) {
+        if (ad_height(n->left->left) < ad_height(n->left->right))
+            n->left = ad_rotate_left(n->left);
+        return ad_rotate_right(n);
+    }
+
+    if (bal < -1) {
+        if (ad_height(n->right->right) < ad_height(n->right->left))
+            n->right = ad_rotate_right(n->right);
+        return ad_rotate_left(n);
+    }
+
+    return n;
+
+}
+
+static struct node *
+ad_insert_at(struct node *n, struct node *add) {
+    if (!n)
+        return add;
+
+    if (add->start < n->start)
+        n->left = ad_insert_at(n->left, add);
+    else
+        n->right = ad_insert_at(n->right, add);
+
+    return ad_balance(n);
+
+}
+
+/**
+ * Unlinks the leftmost node under n into *min.
+ */
+static struct node *
+ad_remove_min(struct node *n, struct node **min) {
+    if (!n->left) {
+        *min = n;
+        return n->right;
+    }
+
+    n->left = ad_remove_min(n->left, min);
+
+    return ad_balance(n);
+
+}
+
+static struct node *
+ad_remove_at(struct node *n, const char *start, struct node **removed) {
+    struct node *min;
+
+    if (!n)
+        return NULL;
+
+    if (start < n->start)
+        n->left = ad_remove_at(n->left, start, removed);
+    else if (start > n->start)
+        n->right = ad_remove_at(n->right, start, removed);
+    else {
+        *removed = n;
+        if (!n->right)
+            return n->left;
+
+        n->right = ad_remove_min(n->right, &min);
+        min->left = n->left;
+        min->right = n->right;
+        n = min;
+    }
+
+    return ad_balance(n);
+
+}
+
+void
+ad_insert(const void *ptr, size_t sz) {
+    struct node *n;
+
+    LOCK();
+    n = sl_alloc(&nodes);
+    n->start = ptr;
+    n->sz = sz;
+    n->left = n->right = NULL;
+    n->height = 1;
+
+    root = ad_insert_at(root, n);
+    UNLOCK();
+
+}
+
+void
+ad_remove(const void *ptr) {
+    struct node *removed = NULL;
+
+    LOCK();
+    root = ad_remove_at(root, ptr, &removed);
+    if (removed)
+        sl_free(&nodes, removed);
+    UNLOCK();
+
+}
+
+int
+ad_find(const void *ptr, const void **base, size_t *sz) {
+    const struct node *n, *best = NULL;
+
+    RDLOCK();
+    for (n = root; n; )
+        if (n->start <= (const char *)ptr) {
+            best = n;
+            n = n->right;
+        }
+        else
+            n = n->left;
+
+    if (!best || (const char *)ptr - best->start >= best->sz) {
+        UNLOCK();
+        return 0;
+    }
+
+    *base = best->start;
+    *sz = best->sz;
+    UNLOCK();
+
+    return 1;
+
+}
@@ -0,0 +1,422 @@
+/**
+ * Copyright (c) 2014-2021, Ignacio Nin <nachex@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <config.h>
+
+#include "binlog.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/syscall.h>
+
+#include "intern.h"
+#include "preload.h"
+#include "uthash.h"
+
+/**
+ * Every thread logs into its own ring of events, which only it writes to and
+ * only the writer thread reads from, so logging takes no locks. The writer
+ * wakes up periodically (or when a ring is filling up), drains all rings
+ * into a large buffer and writes it out in big chunks.
+ *
+ * A thread finding its ring full waits for the writer to catch up, so no
+ * events are lost. Rings of threads that exit are freed by the writer once
+ * drained.
+ *
+ * A child process has no writer, and shares the file with its parent, so
+ * logging is turned off in it as soon as it's forked. Events logged once
+ * logging is off, or the writer has stopped, are dropped.
+ */
+
+#define BL_RING 1024
+#define BL_BUFFER (256 * 1024)
+#define BL_PERIOD (10 * 1000 * 1000)
+#define BL_FLUSHPERIOD (1000 * 1000 * 1000)
+
+struct bl_event {
+    const void *ptr;
+    const void *old;
+    size_t sz;
+    uint64_t time;
+
+    const char *file;
+    int line;
+    enum bl_op op;
+
+};
+
+struct ring {
+    struct bl_event ev[BL_RING];
+
+    unsigned long head __attribute__ (( aligned(64) ));
+    unsigned long tail __attribute__ (( aligned(64) ));
+
+    uint32_t tid;
+    int dead;
+    struct ring *next;
+
+};
+
+/**
+ * Name ids, only ever touched by the writer.
+ */
+struct bl_name {
+    const char *name;
+    uint32_t id;
+
+    UT_hash_handle hh;
+
+};
+
+int bl_enabled;
+
+static __thread struct ring *bl_ring
+    __attribute__ (( tls_model("initial-exec") ));
+
+struct ring *rings;
+pthread_mutex_t rings_mx = PTHREAD_MUTEX_INITIALIZER;
+pthread_key_t bl_key;
+pthread_once_t bl_key_once = PTHREAD_ONCE_INIT;
+
+pthread_t bl_writer;
+sem_t bl_wake;
+int bl_stop;
+int bl_fd = -1;
+
+struct bl_name *bl_names;
+uint32_t bl_nextid;
+char *bl_buf;
+size_t bl_buflen;
+uint64_t bl_lastflush;
+
+static uint64_t
+bl_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+}
+
+static void
+bl_flush(void) {
+    size_t off = 0;
+    ssize_t r;
+
+    while (off < bl_buflen) {
+        r = write(bl_fd, bl_buf + off, bl_buflen - off);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            break;  // Nothing sensible to do about it
+        off += r;
+    }
+
+    bl_buflen = 0;
+    bl_lastflush = bl_now();
+
+}
+
+static void
+bl_put(const void *data, size_t len) {
+    if (bl_buflen + len > BL_BUFFER)
+        bl_flush();
+
+    memcpy(bl_buf + bl_buflen, data, len);
+    bl_buflen += len;
+
+}
+
+static uint32_t
+bl_name_id(const char *name) {
+    struct bl_record rec;
+    struct bl_name *n;
+    size_t len, padded;
+    char pad[sizeof(struct bl_record)];
+
+    HASH_FIND_PTR(bl_names, &name, n);
+    if (n)
+        return n->id;
+
+    n = malloc(sizeof(struct bl_name));
+    if (!n)
+        abort();
+    n->name = name;
+    n->id = bl_nextid++;
+    HASH_ADD_PTR(bl_names, name, n);
+
+    len = strlen(name);
+    memset(&rec, 0, sizeof(struct bl_record));
+    rec.op = BL_NAME;
+    rec.file = n->id;
+    rec.sz = len;
+    bl_put(&rec, sizeof(struct bl_record));
+
+    padded = (len + sizeof(pad) - 1) / sizeof(pad) * sizeof(pad);
+    bl_put(name, len);
+    memset(pad, 0, sizeof(pad));
+    bl_put(pad, padded - len);
+
+    return n->id;
+
+}
+
+static void
+bl_emit(const struct bl_event *ev, uint32_t tid) {
+    struct bl_record rec;
+
+    memset(&rec, 0, sizeof(struct bl_record));
+    rec.ptr = (uintptr_t)ev->ptr;
+    rec.old = (uintptr_t)ev->old;
+    rec.sz = ev->sz;
+    rec.time = ev->time;
+    rec.tid = tid;
+    rec.file = bl_name_id(ev->file);
+    rec.line = ev->line;
+    rec.op = ev->op;
+
+    bl_put(&rec, sizeof(struct bl_record));
+
+}
+
+static void
+bl_drain(void) {
+    struct ring *r, **prev;
+    unsigned long head, tail;
+
+    pthread_mutex_lock(&rings_mx);
+    for (prev = &rings; (r = *prev); ) {
+        head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        for (tail = r->tail; tail != head; tail ++)
+            bl_emit(&r->ev[tail % BL_RING], r->tid);
+        __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+
+        if (__atomic_load_n(&r->dead, __ATOMIC_ACQUIRE) &&
+                __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == tail) {
+            *prev = r->next;
+            free(r);
+        }
+        else
+            prev = &r->next;
+    }
+    pthread_mutex_unlock(&rings_mx);
+
+    if (bl_buflen >= BL_BUFFER / 2 || bl_now() - bl_lastflush > BL_FLUSHPERIOD)
+        bl_flush();
+
+}
+
+static void *
+bl_write(void *arg) {
+    struct timespec ts;
+
+    // What this thread allocates is libxmem's own
+    pl_busy = 1;
+
+    while (!__atomic_load_n(&bl_stop, __ATOMIC_ACQUIRE)) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += BL_PERIOD;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec ++;
+            ts.tv_nsec -= 1000000000;
+        }
+        sem_timedwait(&bl_wake, &ts);
+
+        bl_drain();
+    }
+
+    return NULL;
+
+}
+
+static void
+bl_thread_exit(void *arg) {
+    struct ring *r = arg;
+
+    __atomic_store_n(&r->dead, 1, __ATOMIC_RELEASE);
+    // The writer frees it once drained; frees from later destructors start
+    // a new one
+    bl_ring = NULL;
+
+}
+
+static void
+bl_fork_child(void) {
+    if (!bl_enabled)
+        return;
+
+    bl_enabled = 0;
+    close(bl_fd);
+    bl_fd = -1;
+
+}
+
+static void
+bl_make_key(void) {
+    pthread_key_create(&bl_key, bl_thread_exit);
+    pthread_atfork(NULL, NULL, bl_fork_child);
+
+}
+
+static struct ring *
+bl_register(void) {
+    struct ring *r;
+
+    r = calloc(1, sizeof(struct ring));
+    if (!r)
+        abort();
+    r->tid = syscall(SYS_gettid);
+
+    pthread_mutex_lock(&rings_mx);
+    r->next = rings;
+    rings = r;
+    pthread_mutex_unlock(&rings_mx);
+
+    pthread_setspecific(bl_key, r);
+    bl_ring = r;
+
+    return r;
+
+}
+
+int
+bl_open(const char *path) {
+    char magic[sizeof(struct bl_record)];
+
+    if (bl_enabled)
+        return 1;
+
+    bl_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (bl_fd < 0)
+        return 0;
+
+    bl_buf = malloc(BL_BUFFER);
+    if (!bl_buf)
+        abort();
+    bl_lastflush = bl_now();
+
+    // The magic takes up a whole record to keep the rest aligned
+    memset(magic, 0, sizeof(magic));
+    memcpy(magic, BL_MAGIC, strlen(BL_MAGIC));
+    bl_put(magic, sizeof(magic));
+
+    // May have been closed before
+    __atomic_store_n(&bl_stop, 0, __ATOMIC_RELEASE);
+
+    if (pthread_once(&bl_key_once, bl_make_key) ||
+            sem_init(&bl_wake, 0, 0) ||
+            pthread_create(&bl_writer, NULL, bl_write, NULL)) {
+        close(bl_fd);
+        bl_fd = -1;
+        free(bl_buf);
+        bl_buf = NULL;
+        return 0;
+    }
+
+    bl_enabled = 1;
+
+    return 1;
+
+}
+
+void
+bl_close(void) {
+    struct bl_name *n, *tmp;
+
+    if (!bl_enabled)
+        return;
+
+    bl_enabled = 0;
+    __atomic_store_n(&bl_stop, 1, __ATOMIC_RELEASE);
+    sem_post(&bl_wake);
+    pthread_join(bl_writer, NULL);
+
+    bl_drain();
+    bl_flush();
+    close(bl_fd);
+    bl_fd = -1;
+
+    // Names are defined again in the next log, if any
+    HASH_ITER(hh, bl_names, n, tmp) {
+        HASH_DEL(bl_names, n);
+        free(n);
+    }
+    bl_nextid = 0;
+    free(bl_buf);
+    bl_buf = NULL;
+
+}
+
+void
+bl_log(enum bl_op op, const void *ptr, const void *old, size_t sz,
+        const char *file, int line)
+{
+    struct ring *r = bl_ring;
+    struct bl_event *ev;
+    unsigned long head;
+
+    if (!bl_enabled)
+        return;
+
+    if (!r)
+        r = bl_register();
+
+    head = r->head;
+    while (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= BL_RING) {
+        if (!bl_enabled || __atomic_load_n(&bl_stop, __ATOMIC_ACQUIRE))
+            return;
+        sem_post(&bl_wake);
+        sched_yield();
+    }
+
+    ev = &r->ev[head % BL_RING];
+    ev->ptr = ptr;
+    ev->old = old;
+    ev->sz = sz;
+    ev->time = bl_now();
+    ev->file = in_intern(file);
+    ev->line = line;
+    ev->op = op;
+
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+
+    // Give the writer a nudge when three quarters full
+    if (head + 1 - __atomic_load_n(&r->tail, __ATOMIC_RELAXED) ==
+            BL_RING / 4 * 3)
+        sem_post(&bl_wake);
+
+}
@@ -0,0 +1,79 @@
+/**
+ * Copyright (c) 2014-2021, Ignacio Nin <nachex@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if !defined(BINLOG_H)
+#define BINLOG_H
+
+#include <stdlib.h>
+#include <stdint.h>
+
+/**
+ * Binary memory log. The file starts with BL_MAGIC and continues with
+ * fixed-size records. File names are not repeated in every record; instead
+ * a BL_NAME record (whose sz is the length of the name) is written the first
+ * time a name is used, followed by the name itself padded to a whole number
+ * of records, and later records refer to it by its id.
+ *
+ * Records from different threads are not necessarily written in time
+ * order; sort by time (which is CLOCK_MONOTONIC, in ns) if it matters.
+ */
+
+#define BL_MAGIC "XMEMLOG1"
+
+enum bl_op {
+    BL_NAME,
+    BL_MALLOC,
+    BL_FREE,
+    BL_REALLOC,
+    BL_STRDUP,
+    BL_STRNDUP,
+};
+
+struct bl_record {
+    uint64_t ptr;
+    uint64_t old;
+    uint64_t sz;
+    uint64_t time;
+
+    uint32_t tid;
+    uint32_t file;
+    uint32_t line;
+    uint8_t op;
+    uint8_t pad[3];
+
+};
+
+extern int bl_enabled;
+
+int bl_open(const char *path);
+void bl_close(void);
+
+void bl_log(enum bl_op op, const void *ptr, const void *old, size_t sz,
+        const char *file, int line);
+
+#endif
+
@@ -25,21 +25,87 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-#include "store.h"
+#include <config.h>
+
+#include "header.h"
+#include "profile.h"
+#include "sample.h"
+
+#include <account.h>
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 
-void
-acc_check(const void *ptr, const void *base, char file[], int line) {
+#include <unistd.h>
+#include <sys/mman.h>
+
+/**
+ * Checks in a loop tend to pass the same base over and over, so each thread
+ * remembers its last few lookups. They're good for as long as no block is
+ * freed or reallocated anywhere, which the store's generation tells.
+ *
+ * The base of a check may be anything, so it's looked up in the store even
+ * with headers: reading the header of a pointer that isn't a block may
+ * fault. Blocks left out by sampling aren't in the store; their header is
+ * only read once its page is known to be mapped, and they aren't
+ * remembered, since the generation doesn't tell when they're freed.
+ */
+
+#define ACC_CACHE 4
+
+static __thread struct {
+    const void *base;
     size_t sz;
+    unsigned long generation;
 
-    if (!as_get(base, &sz)) {
-        fprintf(stderr, "Aborting: base %p not found trying to access pointer "
-                "%p at %s line %d\n", base, ptr, file, line);
-        abort();
-    }
+} acc_cache[ACC_CACHE] __attribute__ (( tls_model("initial-exec") ));
+
+static __thread unsigned acc_cache_next
+    __attribute__ (( tls_model("initial-exec") ));
+
+static int
+acc_mapped(const void *ptr) {
+    static uintptr_t pagesz;
+    unsigned char vec;
 
+    if (!pagesz)
+        pagesz = sysconf(_SC_PAGESIZE);
+
+    return !mincore((void *)((uintptr_t)ptr & ~(pagesz - 1)), 1, &vec);
+
+}
+
+static int
+acc_lookup(const void *base, size_t *sz) {
+    unsigned long generation;
+    int i;
+
+    generation = __atomic_load_n(&as_generation, __ATOMIC_ACQUIRE);
+    for (i = 0; i < ACC_CACHE; i ++)
+        if (acc_cache[i].base == base &&
+                acc_cache[i].generation == generation) {
+            *sz = acc_cache[i].sz;
+            return 1;
+        }
+
+    if (!as_get(base, sz))
+        return hd_enabled && sm_rate && base && acc_mapped(hd_get(base)) &&
+            hd_unsampled(base) && hd_lookup(base, sz);
+
+    i = acc_cache_next++ % ACC_CACHE;
+    acc_cache[i].base = base;
+    acc_cache[i].sz = *sz;
+    acc_cache[i].generation = generation;
+
+    return 1;
+
+}
+
+static void
+acc_check_bounds(const void *ptr, const void *base, size_t sz,
+        char file[], int line)
+{
     if (ptr < base) {
         fprintf(stderr, "Aborting: base %p lesser than desired pointer "
                 "%p at %s line %d\n", base, ptr, file, line);
@@ -55,18 +121,10 @@ acc_check(const void *ptr, const void *base, char file[], int line) {
 
 }
 
-void
-acc_checkr(const void *ptr, size_t checksz, const void *base,
-        char file[], int line)
+static void
+acc_checkr_bounds(const void *ptr, size_t checksz, const void *base,
+        size_t sz, char file[], int line)
 {
-    size_t sz;
-
-    if (!as_get(base, &sz)) {
-        fprintf(stderr, "Aborting: base %p not found trying to access range "
-                "%p + %lu at %s line %d\n", base, ptr, checksz, file, line);
-        abort();
-    }
-
     if (ptr < base) {
         fprintf(stderr, "Aborting: base %p lesser than desired range start "
                 "%p at %s line %d\n", base, ptr, file, line);
@@ -87,3 +145,141 @@ acc_checkr(const void *ptr, size_t checksz, const void *base,
     }
 
 }
+
+void
+acc_check(const void *ptr, const void *base, char file[], int line) {
+    size_t sz;
+    PF_BEGIN(t);
+
+    if (!acc_lookup(base, &sz)) {
+        fprintf(stderr, "Aborting: base %p not found trying to access pointer "
+                "%p at %s line %d\n", base, ptr, file, line);
+        abort();
+    }
+
+    acc_check_bounds(ptr, base, sz, file, line);
+    PF_END(t, PF_CHECK);
+
+}
+
+void
+acc_checkr(const void *ptr, size_t checksz, const void *base,
+        char file[], int line)
+{
+    size_t sz;
+    PF_BEGIN(t);
+
+    if (!acc_lookup(base, &sz)) {
+        fprintf(stderr, "Aborting: base %p not found trying to access range "
+                "%p + %lu at %s line %d\n", base, ptr, checksz, file, line);
+        abort();
+    }
+
+    acc_checkr_bounds(ptr, checksz, base, sz, file, line);
+    PF_END(t, PF_CHECK);
+
+}
+
+xmem_bounds_t
+acc_pin(const void *base, char file[], int line) {
+    xmem_bounds_t ret;
+    PF_BEGIN(t);
+
+    if (!acc_lookup(base, &ret.sz)) {
+        fprintf(stderr, "Aborting: base %p not found trying to pin it "
+                "at %s line %d\n", base, file, line);
+        abort();
+    }
+    ret.base = base;
+    PF_END(t, PF_CHECK);
+
+    return ret;
+
+}
+
+/**
+ * The inline pinned checks only tell something is wrong; these say what.
+ */
+void
+acc_check_pinned_fail(const void *ptr, xmem_bounds_t b, char file[],
+        int line)
+{
+    acc_check_bounds(ptr, b.base, b.sz, file, line);
+    abort();
+
+}
+
+void
+acc_checkr_pinned_fail(const void *ptr, size_t checksz, xmem_bounds_t b,
+        char file[], int line)
+{
+    acc_checkr_bounds(ptr, checksz, b.base, b.sz, file, line);
+    abort();
+
+}
+
+/**
+ * Finds the block containing ptr, aborting if it can't be looked for.
+ */
+static int
+acc_find(const void *ptr, const void **base, size_t *sz, char file[],
+        int line)
+{
+    int r;
+
+    r = as_find(ptr, base, sz);
+    if (r < 0) {
+        fprintf(stderr, "Aborting: looking up %p at %s line %d needs the "
+                "address index enabled\n", ptr, file, line);
+        abort();
+    }
+
+    return r;
+
+}
+
+void *
+acc_find_block(const void *ptr, char file[], int line) {
+    const void *base;
+    size_t sz;
+    int found;
+    PF_BEGIN(t);
+
+    found = acc_find(ptr, &base, &sz, file, line);
+    PF_END(t, PF_FIND);
+
+    return found ? (void *)base : NULL;
+
+}
+
+void
+acc_check_any(const void *ptr, char file[], int line) {
+    const void *base;
+    size_t sz;
+    PF_BEGIN(t);
+
+    if (!acc_find(ptr, &base, &sz, file, line)) {
+        fprintf(stderr, "Aborting: pointer %p is not inside any block "
+                "at %s line %d\n", ptr, file, line);
+        abort();
+    }
+    PF_END(t, PF_FIND);
+
+}
+
+void
+acc_checkr_any(const void *ptr, size_t checksz, char file[], int line) {
+    const void *base;
+    size_t sz;
+    PF_BEGIN(t);
+
+    if (!acc_find(ptr, &base, &sz, file, line)) {
+        fprintf(stderr, "Aborting: range %p + %lu does not start inside any "
+                "block at %s line %d\n", ptr, checksz, file, line);
+        abort();
+    }
+
+    acc_checkr_bounds(ptr, checksz, base, sz, file, line);
+    PF_END(t, PF_FIND);
+
+}
@@ -0,0 +1,330 @@
+/**
+ * Copyright (c) 2014-2021, Ignacio Nin <nachex@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+
+#include <config.h>
+
+#include "depot.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <execinfo.h>
+#include <pthread.h>
+
+#include "profile.h"
+
+/**
+ * Stacks are captured by following the chain of frame pointers, unless
+ * configured with --disable-fast-unwind, in which case backtrace() does.
+ * The chain is only followed while it stays within the thread's stack and
+ * keeps going up it, so code built without frame pointers cuts stacks
+ * short but can't send the walk astray. Stack bounds are looked up once
+ * per thread.
+ *
+ * Stacks are found through a fixed hash of chains which are only ever
+ * prepended to, so lookups need no lock; adding a stack takes one, as with
+ * sites. Ids index a table of pages of stack pointers, filled in as stacks
+ * are added and never moved, so they can be read without a lock too.
+ *
+ * Stacks are never freed, and there can be at most DP_MAXSTACKS of them:
+ * past that, new stacks are not recorded and get id 0.
+ */
+
+#define DP_BUCKETS 16384
+#define DP_PAGEBITS 12
+#define DP_PAGE (1 << DP_PAGEBITS)
+#define DP_PAGES 256
+#define DP_MAXSTACKS (DP_PAGE * DP_PAGES)
+#define DP_MAXSKIP 8
+
+// The walk's bounds when the thread's stack can't be found
+#define DP_WINDOW (1024 * 1024)
+
+struct stack {
+    struct stack *next;
+    uint32_t hash;
+    uint32_t id;
+    int depth;
+    void *frames[];
+
+};
+
+int dp_enabled;
+
+// Frames between the program and dp_capture()'s caller
+int dp_skip = 1;
+int dp_depth = DP_DEPTH;
+
+#if defined(XMEM_FAST_UNWIND)
+static __thread uintptr_t dp_low __attribute__ (( tls_model("initial-exec") ));
+static __thread uintptr_t dp_high
+    __attribute__ (( tls_model("initial-exec") ));
+#endif
+
+static struct stack *dp_buckets[DP_BUCKETS];
+static struct stack **dp_pages[DP_PAGES];
+static uint32_t dp_next = 1;
+
+int dp_reentrant;
+pthread_mutex_t depot_mx = PTHREAD_MUTEX_INITIALIZER;
+
+#define LOCK() \
+    do { \
+        if (dp_reentrant) \
+            PF_LOCK(pthread_mutex_trylock(&depot_mx), \
+                    pthread_mutex_lock(&depot_mx)); \
+    } while(0)
+#define UNLOCK() \
+    do { \
+        if (dp_reentrant) \
+            pthread_mutex_unlock(&depot_mx); \
+    } while(0)
+
+void
+dp_set_reentrant(void) {
+    dp_reentrant = 1;
+
+}
+
+void
+dp_enable(void) {
+    void *frame;
+
+    // The first backtrace() loads the unwinder, which allocates; symbolizing
+    // needs it even if capturing doesn't
+    backtrace(&frame, 1);
+    dp_enabled = 1;
+
+}
+
+int
+dp_set_depth(int depth) {
+    if (depth < 1 || depth > DP_MAXDEPTH)
+        return 0;
+
+    dp_depth = depth;
+
+    return depth;
+
+}
+
+static uint32_t
+dp_hash(void *const *frames, int depth) {
+    unsigned long long h = depth;
+    int i;
+
+    for (i = 0; i < depth; i ++)
+        h = (h ^ (unsigned long long)(size_t)frames[i]) *
+            0x9e3779b97f4a7c15ULL;
+
+    return h >> 32;
+
+}
+
+static struct stack *
+dp_search(struct stack *s, uint32_t hash, void *const *frames, int depth) {
+    for (; s; s = s->next)
+        if (s->hash == hash && s->depth == depth &&
+                !memcmp(s->frames, frames, depth * sizeof(void *)))
+            break;
+
+    return s;
+
+}
+
+static uint32_t
+dp_intern(void *const *frames, int depth) {
+    uint32_t hash = dp_hash(frames, depth);
+    struct stack **bucket = &dp_buckets[hash & (DP_BUCKETS - 1)];
+    struct stack ***page;
+    struct stack *s;
+
+    s = dp_search(__atomic_load_n(bucket, __ATOMIC_ACQUIRE), hash, frames,
+            depth);
+    if (s)
+        return s->id;
+
+    LOCK();
+    // Somebody may have added it in the meantime
+    s = dp_search(*bucket, hash, frames, depth);
+    if (!s && dp_next < DP_MAXSTACKS) {
+        page = &dp_pages[dp_next >> DP_PAGEBITS];
+        if (!*page && !(*page = calloc(DP_PAGE, sizeof(struct stack *))))
+            abort();
+
+        s = malloc(sizeof(struct stack) + depth * sizeof(void *));
+        if (!s)
+            abort();
+        s->hash = hash;
+        s->id = dp_next;
+        s->depth = depth;
+        memcpy(s->frames, frames, depth * sizeof(void *));
+        s->next = *bucket;
+
+        (*page)[dp_next & (DP_PAGE - 1)] = s;
+        __atomic_store_n(&dp_next, dp_next + 1, __ATOMIC_RELEASE);
+        __atomic_store_n(bucket, s, __ATOMIC_RELEASE);
+    }
+    UNLOCK();
+
+    return s ? s->id : 0;
+
+}
+
+#if defined(XMEM_FAST_UNWIND)
+static void
+dp_bounds(uintptr_t fp) {
+    pthread_attr_t attr;
+    void *addr;
+    size_t sz;
+
+    if (!pthread_getattr_np(pthread_self(), &attr)) {
+        if (!pthread_attr_getstack(&attr, &addr, &sz)) {
+            dp_low = (uintptr_t)addr;
+            dp_high = (uintptr_t)addr + sz;
+        }
+        pthread_attr_destroy(&attr);
+    }
+
+    // Some other stack, or none found
+    if (fp < dp_low || fp >= dp_high) {
+        dp_low = fp;
+        dp_high = fp + DP_WINDOW;
+    }
+
+}
+
+/**
+ * Fills in the return addresses of up to max frames, starting from the
+ * frame at fp, and returns how many.
+ */
+static int
+dp_unwind(uintptr_t fp, void **frames, int max) {
+    uintptr_t next;
+    int n = 0;
+
+    if (fp < dp_low || fp >= dp_high)
+        dp_bounds(fp);
+
+    while (n < max) {
+        // Each frame holds the caller's frame pointer and the return address
+        if (fp < dp_low || fp > dp_high - 2 * sizeof(void *) ||
+                fp & (sizeof(void *) - 1))
+            break;
+
+        frames[n] = ((void **)fp)[1];
+        if (!frames[n])
+            break;
+        n ++;
+
+        next = ((uintptr_t *)fp)[0];
+        if (next <= fp)
+            break;
+        fp = next;
+    }
+
+    return n;
+
+}
+#endif
+
+/**
+ * Returns the id of the current stack, leaving out this function's own
+ * frame, its caller's and dp_skip more.
+ */
+uint32_t __attribute__ (( noinline ))
+dp_capture(void) {
+    void *frames[DP_MAXDEPTH + DP_MAXSKIP];
+    int skip = dp_skip < DP_MAXSKIP ? dp_skip : DP_MAXSKIP, n;
+
+#if defined(XMEM_FAST_UNWIND)
+    // Starts at the caller's return address, so this frame is left out
+    n = dp_unwind((uintptr_t)__builtin_frame_address(0), frames,
+            dp_depth + skip);
+#else
+    // This frame comes first
+    skip ++;
+    n = backtrace(frames, dp_depth + skip);
+#endif
+    if (n <= skip)
+        return 0;
+
+    return dp_intern(frames + skip, n - skip);
+
+}
+
+/**
+ * One past the highest id handed out so far.
+ */
+uint32_t
+dp_count(void) {
+    return __atomic_load_n(&dp_next, __ATOMIC_ACQUIRE);
+
+}
+
+/**
+ * Returns the depth of the stack, or 0 if there's no such stack.
+ */
+int
+dp_frames(uint32_t id, void *const **frames) {
+    struct stack *s;
+
+    if (!id || id >= dp_count())
+        return 0;
+
+    s = dp_pages[id >> DP_PAGEBITS][id & (DP_PAGE - 1)];
+    *frames = s->frames;
+
+    return s->depth;
+
+}
+
+/**
+ * Prints a frame per line, symbolized as well as backtrace_symbols() can.
+ */
+void
+dp_print(FILE *out, uint32_t id, const char *indent) {
+    void *const *frames;
+    char **symbols;
+    int depth, i;
+
+    depth = dp_frames(id, &frames);
+    if (!depth)
+        return;
+
+    symbols = backtrace_symbols(frames, depth);
+    for (i = 0; i < depth; i ++)
+        if (symbols)
+            fprintf(out, "%s%s\n", indent, symbols[i]);
+        else
+            fprintf(out, "%s%p\n", indent, frames[i]);
+    free(symbols);
+
+}
+
@@ -0,0 +1,115 @@
+/**
+ * Copyright (c) 2014-2021, Ignacio Nin <nachex@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <config.h>
+
+#include "dump.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+
+#include <pthread.h>
+#include <semaphore.h>
+
+#include <account.h>
+
+#include "preload.h"
+
+/**
+ * Dumping forks and waits for the child, which takes too long (and allocates)
+ * to be done from a signal handler. The handler posts a semaphore instead,
+ * which is all it's allowed to do, and the dumper thread waits on it.
+ * Signals arriving while a dump is in progress make for one more dump.
+ */
+
+static char *du_path;
+static sem_t du_wake;
+static pthread_t du_dumper;
+
+static void
+du_handler(int sig) {
+    int saved = errno;
+
+    sem_post(&du_wake);
+    errno = saved;
+
+}
+
+static void *
+du_dump(void *arg) {
+    // What this thread allocates is libxmem's own
+    pl_busy = 1;
+
+    for (;;) {
+        if (sem_wait(&du_wake))
+            continue;
+
+        acc_dump_heap(du_path);
+    }
+
+    return NULL;
+
+}
+
+/**
+ * Can only be set up once.
+ */
+int
+du_on_signal(int sig, const char *path) {
+    struct sigaction sa;
+
+    if (du_path || !path || !*path)
+        return 0;
+
+    du_path = strdup(path);
+    if (!du_path)
+        return 0;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = du_handler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+
+    if (sem_init(&du_wake, 0, 0) ||
+            pthread_create(&du_dumper, NULL, du_dump, NULL)) {
+        free(du_path);
+        du_path = NULL;
+        return 0;
+    }
+    pthread_detach(du_dumper);
+
+    if (sigaction(sig, &sa, NULL)) {
+        // The thread stays, waiting for nothing
+        return 0;
+    }
+
+    return 1;
+
+}
+
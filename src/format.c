@@ -0,0 +1,476 @@
+/**
+ * Copyright (c) 2014-2021, Ignacio Nin <nachex@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "format.h"
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <wchar.h>
+
+/**
+ * Deferred formatting of printf-like descriptions.
+ *
+ * fm_capture() walks the format once and copies every argument it consumes
+ * into a flat buffer, each one aligned to its type. Strings are copied too,
+ * since the caller is free to change them once xmalloc() returns. The format
+ * string itself is not copied, so it must outlive the capture (which it
+ * does when it's a literal, the normal case).
+ *
+ * fm_render() walks the format again, this time feeding the captured
+ * arguments to one printf call per conversion.
+ *
+ * Conversions we can't reproduce faithfully later (%n, %m, wide strings,
+ * positional arguments) make fm_capture() fail, and the caller should fall
+ * back to formatting right away.
+ */
+
+enum fm_type {
+    FM_NONE,
+    FM_INT,
+    FM_UINT,
+    FM_LONG,
+    FM_ULONG,
+    FM_LLONG,
+    FM_ULLONG,
+    FM_INTMAX,
+    FM_UINTMAX,
+    FM_SIZE,
+    FM_PTRDIFF,
+    FM_WINT,
+    FM_DOUBLE,
+    FM_LDOUBLE,
+    FM_PTR,
+    FM_STR,
+};
+
+struct fm_spec {
+    int wstar;
+    int pstar;
+    int prec;
+    enum fm_type type;
+
+    const char *start;
+    size_t len;
+
+};
+
+/**
+ * Parses the conversion at fmt (just after the '%'). Returns 0 if it's not
+ * one we support.
+ */
+static int
+fm_parse(const char *fmt, struct fm_spec *spec) {
+    const char *p = fmt;
+    enum { L_NONE, L_HH, L_H, L_L, L_LL, L_J, L_Z, L_T, L_BIGL } len;
+
+    memset(spec, 0, sizeof(struct fm_spec));
+    spec->start = fmt - 1;
+    spec->prec = -1;
+
+    while (*p && strchr("-+ #0'I", *p))
+        p ++;
+
+    if (*p == '*') {
+        spec->wstar = 1;
+        p ++;
+    }
+    else {
+        while (*p >= '0' && *p <= '9')
+            p ++;
+        if (*p == '$')
+            return 0;
+    }
+
+    if (*p == '.') {
+        p ++;
+        if (*p == '*') {
+            spec->pstar = 1;
+            p ++;
+        }
+        else {
+            spec->prec = 0;
+            while (*p >= '0' && *p <= '9')
+                spec->prec = spec->prec * 10 + *p++ - '0';
+        }
+    }
+
+    len = L_NONE;
+    switch (*p) {
+    case 'h':
+        len = p[1] == 'h' ? L_HH : L_H;
+        p += len == L_HH ? 2 : 1;
+        break;
+    case 'l':
+        len = p[1] == 'l' ? L_LL : L_L;
+        p += len == L_LL ? 2 : 1;
+        break;
+    case 'q':
+        len = L_LL;
+        p ++;
+        break;
+    case 'j':
+        len = L_J;
+        p ++;
+        break;
+    case 'z':
+    case 'Z':
+        len = L_Z;
+        p ++;
+        break;
+    case 't':
+        len = L_T;
+        p ++;
+        break;
+    case 'L':
+        len = L_BIGL;
+        p ++;
+        break;
+    }
+
+    switch (*p) {
+    case 'd':
+    case 'i':
+        spec->type = len == L_L ? FM_LONG : len == L_LL ? FM_LLONG :
+            len == L_J ? FM_INTMAX : len == L_Z ? FM_SIZE :
+            len == L_T ? FM_PTRDIFF : FM_INT;
+        break;
+    case 'o':
+    case 'u':
+    case 'x':
+    case 'X':
+        spec->type = len == L_L ? FM_ULONG : len == L_LL ? FM_ULLONG :
+            len == L_J ? FM_UINTMAX : len == L_Z ? FM_SIZE :
+            len == L_T ? FM_PTRDIFF : FM_UINT;
+        break;
+    case 'c':
+        spec->type = len == L_L ? FM_WINT : FM_INT;
+        break;
+    case 'e':
+    case 'E':
+    case 'f':
+    case 'F':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+        spec->type = len == L_BIGL ? FM_LDOUBLE : FM_DOUBLE;
+        break;
+    case 'p':
+        spec->type = FM_PTR;
+        break;
+    case 's':
+        if (len == L_L)
+            return 0;
+        spec->type = FM_STR;
+        break;
+    default:
+        // %n, %m, %S, %C and anything unknown
+        return 0;
+    }
+
+    spec->len = p + 1 - spec->start;
+
+    return 1;
+
+}
+
+static size_t
+fm_align(size_t off, size_t align) {
+    return (off + align - 1) & ~(align - 1);
+
+}
+
+#define PUT(type, val) \
+    do { \
+        type v__ = (val); \
+        off = fm_align(off, _Alignof(type)); \
+        if (off + sizeof(type) > bufsz) \
+            return -1; \
+        memcpy((char *)buf + off, &v__, sizeof(type)); \
+        off += sizeof(type); \
+    } while (0)
+
+#define GET(type, var) \
+    do { \
+        off = fm_align(off, _Alignof(type)); \
+        memcpy(&(var), (const char *)buf + off, sizeof(type)); \
+        off += sizeof(type); \
+    } while (0)
+
+int
+fm_capture(void *buf, size_t bufsz, const char fmt[], va_list args) {
+    struct fm_spec spec;
+    const char *p;
+    size_t off = 0;
+    int prec;
+
+    for (p = fmt; *p; p ++) {
+        if (*p != '%')
+            continue;
+        if (*++p == '%')
+            continue;
+
+        if (!fm_parse(p, &spec))
+            return -1;
+        p = spec.start + spec.len - 1;
+
+        if (spec.wstar)
+            PUT(int, va_arg(args, int));
+        prec = spec.prec;
+        if (spec.pstar) {
+            prec = va_arg(args, int);
+            PUT(int, prec);
+        }
+
+        switch (spec.type) {
+        case FM_INT:
+            PUT(int, va_arg(args, int));
+            break;
+        case FM_UINT:
+            PUT(unsigned, va_arg(args, unsigned));
+            break;
+        case FM_LONG:
+            PUT(long, va_arg(args, long));
+            break;
+        case FM_ULONG:
+            PUT(unsigned long, va_arg(args, unsigned long));
+            break;
+        case FM_LLONG:
+            PUT(long long, va_arg(args, long long));
+            break;
+        case FM_ULLONG:
+            PUT(unsigned long long, va_arg(args, unsigned long long));
+            break;
+        case FM_INTMAX:
+            PUT(intmax_t, va_arg(args, intmax_t));
+            break;
+        case FM_UINTMAX:
+            PUT(uintmax_t, va_arg(args, uintmax_t));
+            break;
+        case FM_SIZE:
+            PUT(size_t, va_arg(args, size_t));
+            break;
+        case FM_PTRDIFF:
+            PUT(ptrdiff_t, va_arg(args, ptrdiff_t));
+            break;
+        case FM_WINT:
+            PUT(wint_t, va_arg(args, wint_t));
+            break;
+        case FM_DOUBLE:
+            PUT(double, va_arg(args, double));
+            break;
+        case FM_LDOUBLE:
+            PUT(long double, va_arg(args, long double));
+            break;
+        case FM_PTR:
+            PUT(void *, va_arg(args, void *));
+            break;
+        case FM_STR: {
+            const char *s = va_arg(args, const char *);
+            size_t slen;
+
+            // A NULL string is kept as such, printf knows what to do
+            PUT(const char *, s);
+            if (!s)
+                break;
+
+            slen = prec >= 0 ? strnlen(s, prec) : strlen(s);
+            if (off + slen + 1 > bufsz)
+                return -1;
+            memcpy((char *)buf + off, s, slen);
+            ((char *)buf)[off + slen] = '\0';
+            off += slen + 1;
+            break;
+        }
+        case FM_NONE:
+            break;
+        }
+
+    }
+
+    return off;
+
+}
+
+/**
+ * Prints a single conversion. The width and precision, if given as '*', are
+ * passed along in w and pr.
+ */
+#define EMIT(type) \
+    do { \
+        type v__; \
+        GET(type, v__); \
+        if (spec.wstar && spec.pstar) \
+            fprintf(out, conv, w, pr, v__); \
+        else if (spec.wstar) \
+            fprintf(out, conv, w, v__); \
+        else if (spec.pstar) \
+            fprintf(out, conv, pr, v__); \
+        else \
+            fprintf(out, conv, v__); \
+    } while (0)
+
+char *
+fm_render(const char fmt[], const void *buf) {
+    struct fm_spec spec;
+    const char *p, *lit;
+    char conv[64];
+    size_t off = 0, outsz;
+    char *ret;
+    FILE *out;
+    int w = 0, pr = 0;
+
+    out = open_memstream(&ret, &outsz);
+    if (!out)
+        abort();
+
+    for (lit = p = fmt; *p; p ++) {
+        if (*p != '%')
+            continue;
+        fwrite(lit, 1, p - lit, out);
+        if (*++p == '%') {
+            fputc('%', out);
+            lit = p + 1;
+            continue;
+        }
+
+        // Known to succeed, it did at capture time
+        fm_parse(p, &spec);
+        p = spec.start + spec.len - 1;
+        lit = p + 1;
+
+        if (spec.len >= sizeof(conv))
+            abort();
+        memcpy(conv, spec.start, spec.len);
+        conv[spec.len] = '\0';
+
+        if (spec.wstar)
+            GET(int, w);
+        if (spec.pstar)
+            GET(int, pr);
+
+        switch (spec.type) {
+        case FM_INT:
+            EMIT(int);
+            break;
+        case FM_UINT:
+            EMIT(unsigned);
+            break;
+        case FM_LONG:
+            EMIT(long);
+            break;
+        case FM_ULONG:
+            EMIT(unsigned long);
+            break;
+        case FM_LLONG:
+            EMIT(long long);
+            break;
+        case FM_ULLONG:
+            EMIT(unsigned long long);
+            break;
+        case FM_INTMAX:
+            EMIT(intmax_t);
+            break;
+        case FM_UINTMAX:
+            EMIT(uintmax_t);
+            break;
+        case FM_SIZE:
+            EMIT(size_t);
+            break;
+        case FM_PTRDIFF:
+            EMIT(ptrdiff_t);
+            break;
+        case FM_WINT:
+            EMIT(wint_t);
+            break;
+        case FM_DOUBLE:
+            EMIT(double);
+            break;
+        case FM_LDOUBLE:
+            EMIT(long double);
+            break;
+        case FM_PTR:
+            EMIT(void *);
+            break;
+        case FM_STR: {
+            const char *s;
+
+            GET(const char *, s);
+            if (s) {
+                // Point at our copy rather than the original
+                s = (const char *)buf + off;
+                off += strlen(s) + 1;
+            }
+            if (spec.wstar && spec.pstar)
+                fprintf(out, conv, w, pr, s);
+            else if (spec.wstar)
+                fprintf(out, conv, w, s);
+            else if (spec.pstar)
+                fprintf(out, conv, pr, s);
+            else
+                fprintf(out, conv, s);
+            break;
+        }
+        case FM_NONE:
+            break;
+        }
+
+    }
+    fwrite(lit, 1, p - lit, out);
+
+    if (fclose(out))
+        abort();
+
+    return ret;
+
+}
+
+/**
+ * Writes the digits of n, with no terminator, and returns how many. Unlike
+ * the printf family it's safe in a signal handler, or after forking a
+ * threaded process.
+ */
+int
+fm_ulong(char *buf, unsigned long n) {
+    char digits[FM_ULONGDIGITS];
+    int len = 0;
+
+    do {
+        digits[len ++] = '0' + n % 10;
+        n /= 10;
+    } while (n);
+
+    for (n = 0; n < len; n ++)
+        buf[n] = digits[len - n - 1];
+
+    return len;
+
+}
@@ -0,0 +1,121 @@
+/**
+ * Copyright (c) 2014-2021, Ignacio Nin <nachex@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if !defined(HEADER_H)
+#define HEADER_H
+
+#include <stdlib.h>
+#include <stddef.h>
+
+#include "store.h"
+
+/**
+ * In header mode every block is over-allocated and carries its own size
+ * right before the pointer handed to the user, so that freeing and
+ * reallocating don't need to go through the store. The store is still kept
+ * up to date for walking, reporting and telling checks whether a pointer
+ * is a block at all: only pointers known to be blocks may have their header
+ * read.
+ *
+ * The header is padded at the front so that the user pointer keeps the
+ * alignment malloc() gives.
+ */
+
+#define HD_MAGIC 0x584d454dU    // "XMEM"
+#define HD_FREED 0x46524545U    // "FREE"
+#define HD_UNSAMPLED 0x4e4f4e45U    // "NONE", a live block not in the store
+
+struct header {
+    size_t sz;
+    unsigned magic;
+
+};
+
+#define HD_SIZE ((sizeof(struct header) + _Alignof(max_align_t) - 1) & \
+        ~(_Alignof(max_align_t) - 1))
+
+extern int hd_enabled;
+
+static inline struct header *
+hd_get(const void *ptr) {
+    return (struct header *)ptr - 1;
+
+}
+
+static inline void *
+hd_raw(const void *ptr) {
+    return (char *)ptr - HD_SIZE;
+
+}
+
+static inline void *
+hd_init(void *raw, size_t sz) {
+    void *ptr = (char *)raw + HD_SIZE;
+    struct header *hd = hd_get(ptr);
+
+    hd->sz = sz;
+    hd->magic = HD_MAGIC;
+
+    return ptr;
+
+}
+
+/**
+ * Looks up the size of a live block, through its header if headers are
+ * enabled and through the store otherwise. The pointer must be one handed
+ * out by libxmem, or at least one whose header can be read.
+ */
+static inline int
+hd_lookup(const void *ptr, size_t *sz) {
+    const struct header *hd;
+
+    if (!hd_enabled)
+        return as_get(ptr, sz);
+
+    if (!ptr)
+        return 0;
+
+    hd = hd_get(ptr);
+    if (hd->magic != HD_MAGIC && hd->magic != HD_UNSAMPLED)
+        return 0;
+
+    *sz = hd->sz;
+    return 1;
+
+}
+
+/**
+ * Whether ptr is a live block left out by sampling.
+ */
+static inline int
+hd_unsampled(const void *ptr) {
+    return hd_enabled && ptr && hd_get(ptr)->magic == HD_UNSAMPLED;
+
+}
+
+#endif
+
@@ -0,0 +1,139 @@
+/**
+ * Copyright (c) 2014-2021, Ignacio Nin <nachex@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <config.h>
+
+#include "intern.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#include "profile.h"
+#include "uthash.h"
+
+/**
+ * Source file names come from __FILE__, so there are only a handful of
+ * distinct ones but they're handed to us on every single allocation. Each
+ * name is copied once and shared by every record that refers to it.
+ *
+ * Lookups go first by the address of the string (the common case, since the
+ * same literal is passed every time) and only then by its contents, in which
+ * case the new address is remembered as an alias of the existing name.
+ * Interned names live until the process exits.
+ *
+ * Each thread also remembers its last few lookups, so that the shared table
+ * (and its lock) is only consulted the first time a thread sees a name.
+ */
+
+#define IN_CACHE 8
+
+struct name {
+    char *str;
+
+    UT_hash_handle hh;
+
+} *names;
+
+struct alias {
+    const char *ptr;
+    const char *name;
+
+    UT_hash_handle hh;
+
+} *aliases;
+
+static __thread struct {
+    const char *ptr;
+    const char *name;
+
+} in_cache[IN_CACHE] __attribute__ (( tls_model("initial-exec") ));
+
+int in_reentrant;
+pthread_mutex_t intern_mx = PTHREAD_MUTEX_INITIALIZER;
+
+#define LOCK() \
+    do { \
+        if (in_reentrant) \
+            PF_LOCK(pthread_mutex_trylock(&intern_mx), \
+                    pthread_mutex_lock(&intern_mx)); \
+    } while(0)
+#define UNLOCK() \
+    do { \
+        if (in_reentrant) \
+            pthread_mutex_unlock(&intern_mx); \
+    } while(0)
+
+void
+in_set_reentrant(void) {
+    in_reentrant = 1;
+
+}
+
+const char *
+in_intern(const char *ptr) {
+    struct alias *a;
+    struct name *n;
+    const char *ret;
+    unsigned slot;
+
+    slot = ((size_t)ptr >> 3) % IN_CACHE;
+    if (in_cache[slot].ptr == ptr)
+        return in_cache[slot].name;
+
+    LOCK();
+    HASH_FIND_PTR(aliases, &ptr, a);
+    if (!a) {
+        HASH_FIND_STR(names, ptr, n);
+        if (!n) {
+            n = malloc(sizeof(struct name));
+            if (!n)
+                abort();
+            n->str = strdup(ptr);
+            if (!n->str)
+                abort();
+            HASH_ADD_KEYPTR(hh, names, n->str, strlen(n->str), n);
+        }
+
+        a = malloc(sizeof(struct alias));
+        if (!a)
+            abort();
+        a->ptr = ptr;
+        a->name = n->str;
+        HASH_ADD_PTR(aliases, ptr, a);
+    }
+
+    ret = a->name;
+    UNLOCK();
+
+    in_cache[slot].ptr = ptr;
+    in_cache[slot].name = ret;
+
+    return ret;
+
+}
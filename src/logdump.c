@@ -0,0 +1,86 @@
+/**
+ * Copyright (c) 2014-2021, Ignacio Nin <nachex@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "logread.h"
+
+/**
+ * xmem-logdump: converts a binary memory log into the text format written by
+ * xmem_enable_memlog(), in time order. The binary log doesn't carry the
+ * texts given to xmalloc(), so those are left empty.
+ */
+
+int
+main(int argc, char *argv[]) {
+    struct lr_event *events;
+    size_t nevents, i;
+
+    if (argc != 2) {
+        fprintf(stderr, "Syntax: %s memory.log\n", argv[0]);
+        return 2;
+    }
+
+    if (!lr_load(argv[1], &events, &nevents))
+        return 1;
+
+    for (i = 0; i < nevents; i ++) {
+        const struct lr_event *e = &events[i];
+        void *ptr = (void *)(uintptr_t)e->ptr;
+
+        switch (e->op) {
+        case BL_MALLOC:
+            printf("%p: allocated %lu bytes at %s line %u: \n",
+                    ptr, (unsigned long)e->sz, e->file, e->line);
+            break;
+        case BL_FREE:
+            printf("%p: freed from %s line %u\n", ptr, e->file, e->line);
+            break;
+        case BL_REALLOC:
+            printf("%p: reallocated %p to %lu bytes at %s line %u\n",
+                    ptr, (void *)(uintptr_t)e->old, (unsigned long)e->sz,
+                    e->file, e->line);
+            break;
+        case BL_STRDUP:
+            printf("%p: strduped %lu bytes at %s line %u: \n",
+                    ptr, (unsigned long)e->sz, e->file, e->line);
+            break;
+        case BL_STRNDUP:
+            printf("%p: strnduped %lu bytes at %s line %u: \n",
+                    ptr, (unsigned long)e->sz, e->file, e->line);
+            break;
+        default:
+            break;
+        }
+    }
+
+    return 0;
+
+}
@@ -0,0 +1,275 @@
+/**
+ * Copyright (c) 2014-2021, Ignacio Nin <nachex@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <config.h>
+
+#include "logread.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "uthash.h"
+
+struct lr_name {
+    char *name;
+    UT_hash_handle hh;
+
+};
+
+struct lr_entry {
+    struct lr_event ev;
+    uint64_t time;
+    size_t seq;
+
+};
+
+static struct lr_entry *lr_entries;
+static size_t lr_count;
+static size_t lr_allocated;
+
+static struct lr_name *lr_names;
+
+static struct lr_entry *
+lr_append(void) {
+    if (lr_count == lr_allocated) {
+        lr_allocated = lr_allocated ? lr_allocated * 2 : 4096;
+        lr_entries = realloc(lr_entries,
+                lr_allocated * sizeof(struct lr_entry));
+        if (!lr_entries)
+            abort();
+    }
+
+    memset(&lr_entries[lr_count], 0, sizeof(struct lr_entry));
+    lr_entries[lr_count].seq = lr_count;
+
+    return &lr_entries[lr_count++];
+
+}
+
+static const char *
+lr_name(const char *name) {
+    struct lr_name *n;
+
+    HASH_FIND_STR(lr_names, name, n);
+    if (n)
+        return n->name;
+
+    n = malloc(sizeof(struct lr_name));
+    if (!n || !(n->name = strdup(name)))
+        abort();
+    HASH_ADD_KEYPTR(hh, lr_names, n->name, strlen(n->name), n);
+
+    return n->name;
+
+}
+
+/**
+ * Addresses are parsed by hand since %p doesn't read back glibc's "(nil)".
+ */
+static uint64_t
+lr_ptr(const char *s) {
+    return strcmp(s, "(nil)") ? strtoull(s, NULL, 16) : 0;
+
+}
+
+static int
+lr_parse_line(const char *line) {
+    char ptr[32], old[32], file[1024];
+    unsigned long sz;
+    unsigned int ln;
+    struct lr_entry *e;
+
+    if (sscanf(line, "%31s allocated %lu bytes at %1023s line %u",
+                ptr, &sz, file, &ln) == 4) {
+        e = lr_append();
+        e->ev.op = BL_MALLOC;
+    }
+    else if (sscanf(line, "%31s freed from %1023s line %u",
+                ptr, file, &ln) == 3) {
+        e = lr_append();
+        e->ev.op = BL_FREE;
+        sz = 0;
+    }
+    else if (sscanf(line, "%31s reallocated %31s to %lu bytes at %1023s "
+                "line %u", ptr, old, &sz, file, &ln) == 5) {
+        e = lr_append();
+        e->ev.op = BL_REALLOC;
+        e->ev.old = lr_ptr(old);
+    }
+    else if (sscanf(line, "%31s strduped %lu bytes at %1023s line %u",
+                ptr, &sz, file, &ln) == 4) {
+        e = lr_append();
+        e->ev.op = BL_STRDUP;
+    }
+    else if (sscanf(line, "%31s strnduped %lu bytes at %1023s line %u",
+                ptr, &sz, file, &ln) == 4) {
+        e = lr_append();
+        e->ev.op = BL_STRNDUP;
+    }
+    else
+        return 0;
+
+    // strtoull() stops at the colon after the address
+    e->ev.ptr = lr_ptr(ptr);
+    e->ev.sz = sz;
+    e->ev.file = lr_name(file);
+    e->ev.line = ln;
+
+    return 1;
+
+}
+
+/**
+ * Texts given to xmalloc() may span several lines, so lines that don't
+ * parse are skipped rather than treated as errors.
+ */
+static int
+lr_load_text(FILE *in) {
+    char *line = NULL;
+    size_t len = 0;
+
+    while (getline(&line, &len, in) != -1)
+        lr_parse_line(line);
+    free(line);
+
+    return 1;
+
+}
+
+static int
+lr_load_binary(FILE *in, const char *path) {
+    struct bl_record rec;
+    const char **names = NULL;
+    size_t nnames = 0, len;
+    char *name;
+    struct lr_entry *e;
+
+    while (fread(&rec, sizeof(rec), 1, in) == 1) {
+        if (rec.op == BL_NAME) {
+            if (rec.file >= nnames) {
+                names = realloc(names, (rec.file + 1) * sizeof(char *));
+                if (!names)
+                    abort();
+                memset(names + nnames, 0,
+                        (rec.file + 1 - nnames) * sizeof(char *));
+                nnames = rec.file + 1;
+            }
+
+            len = (rec.sz + sizeof(rec) - 1) / sizeof(rec) * sizeof(rec);
+            name = calloc(1, len + 1);
+            if (!name)
+                abort();
+            if (len && fread(name, len, 1, in) != 1) {
+                fprintf(stderr, "%s: truncated name\n", path);
+                return 0;
+            }
+            names[rec.file] = lr_name(name);
+            free(name);
+            continue;
+        }
+
+        e = lr_append();
+        e->ev.op = rec.op;
+        e->ev.ptr = rec.ptr;
+        e->ev.old = rec.old;
+        e->ev.sz = rec.sz;
+        e->ev.tid = rec.tid;
+        e->ev.line = rec.line;
+        e->ev.file = rec.file < nnames && names[rec.file] ?
+            names[rec.file] : "?";
+        e->time = rec.time;
+    }
+    free(names);
+
+    return 1;
+
+}
+
+static int
+lr_compare(const void *a, const void *b) {
+    const struct lr_entry *ea = a, *eb = b;
+
+    if (ea->time != eb->time)
+        return ea->time < eb->time ? -1 : 1;
+
+    return ea->seq < eb->seq ? -1 : ea->seq > eb->seq;
+
+}
+
+int
+lr_load(const char *path, struct lr_event **events, size_t *nevents) {
+    char magic[sizeof(BL_MAGIC) - 1];
+    size_t i;
+    FILE *in;
+    int ok;
+
+    in = strcmp(path, "-") ? fopen(path, "rb") : stdin;
+    if (!in) {
+        perror(path);
+        return 0;
+    }
+
+    if (fread(magic, sizeof(magic), 1, in) == 1 &&
+            !memcmp(magic, BL_MAGIC, sizeof(magic))) {
+        // The magic takes up a whole record
+        char skip[sizeof(struct bl_record) - sizeof(magic)];
+
+        ok = fread(skip, sizeof(skip), 1, in) == 1 &&
+            lr_load_binary(in, path);
+        if (ok)
+            qsort(lr_entries, lr_count, sizeof(struct lr_entry), lr_compare);
+    }
+    else if (in != stdin && !fseek(in, 0, SEEK_SET))
+        // Start over, what was read wasn't a magic
+        ok = lr_load_text(in);
+    else {
+        fprintf(stderr, "%s: can't read a text log from a pipe\n", path);
+        ok = 0;
+    }
+
+    if (in != stdin)
+        fclose(in);
+    if (!ok)
+        return 0;
+
+    // Hand out bare events, the sort keys aren't needed anymore
+    *events = malloc((lr_count ? lr_count : 1) * sizeof(struct lr_event));
+    if (!*events)
+        abort();
+    for (i = 0; i < lr_count; i ++)
+        (*events)[i] = lr_entries[i].ev;
+    *nevents = lr_count;
+
+    free(lr_entries);
+    lr_entries = NULL;
+    lr_count = lr_allocated = 0;
+
+    return 1;
+
+}
+
@@ -0,0 +1,347 @@
+/**
+ * Copyright (c) 2014-2021, Ignacio Nin <nachex@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <config.h>
+
+#include "options.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+
+#include <account.h>
+
+#include "preload.h"
+
+/**
+ * Settings are applied in order, each through the same call a program would
+ * make. They're parsed without allocating, since this runs before anything
+ * else in the process may expect malloc() to be usable. A setting that
+ * can't be parsed or applied is reported on stderr and skipped.
+ */
+
+#define OP_MAXVALUE PATH_MAX
+
+/**
+ * Flags accept no value, 1/0, yes/no, or true/false. Returns -1 for
+ * anything else.
+ */
+static int
+op_flag(const char *value) {
+    if (!value || !strcmp(value, "1") || !strcmp(value, "yes") ||
+            !strcmp(value, "true"))
+        return 1;
+    if (!strcmp(value, "0") || !strcmp(value, "no") ||
+            !strcmp(value, "false"))
+        return 0;
+
+    return -1;
+
+}
+
+/**
+ * Sizes are a number with an optional k, m or g suffix. Returns 0 for
+ * anything else, including sizes that don't fit in a size_t.
+ */
+static size_t
+op_size(const char *value) {
+    unsigned long long n;
+    unsigned shift = 0;
+    char *end;
+
+    if (!value || *value < '0' || *value > '9')
+        return 0;
+
+    errno = 0;
+    n = strtoull(value, &end, 10);
+    if (errno)
+        return 0;
+
+    switch (*end) {
+    case 'g': case 'G':
+        shift += 10;
+        // Fall through
+    case 'm': case 'M':
+        shift += 10;
+        // Fall through
+    case 'k': case 'K':
+        shift += 10;
+        end ++;
+        break;
+    }
+
+    if (*end || n > SIZE_MAX >> shift)
+        return 0;
+
+    return (size_t)n << shift;
+
+}
+
+static int
+op_reentrant(const char *value) {
+    int on = op_flag(value);
+
+    if (on == 1)
+        acc_set_reentrant();
+
+    return on != -1;
+
+}
+
+static int
+op_shards(const char *value) {
+    size_t n = op_size(value);
+
+    return n && n <= INT_MAX && acc_set_shards(n);
+
+}
+
+static int
+op_reserve(const char *value) {
+    size_t n = op_size(value);
+
+    if (n)
+        acc_reserve(n);
+
+    return n != 0;
+
+}
+
+static int
+op_lazy_text(const char *value) {
+    int on = op_flag(value);
+
+    if (on == 1)
+        acc_set_lazy_text();
+
+    return on != -1;
+
+}
+
+static int
+op_headers(const char *value) {
+    int on = op_flag(value);
+
+    return on == 0 || (on == 1 && acc_enable_headers());
+
+}
+
+static int
+op_sample(const char *value) {
+    size_t rate = op_size(value);
+
+    return rate && acc_set_sampling(rate);
+
+}
+
+static int
+op_addr_index(const char *value) {
+    int on = op_flag(value);
+
+    return on == 0 || (on == 1 && acc_enable_address_index());
+
+}
+
+static int
+op_stacks(const char *value) {
+    int on = op_flag(value);
+
+    return on == 0 || (on == 1 && acc_enable_stacks());
+
+}
+
+static int
+op_stack_depth(const char *value) {
+    size_t depth = op_size(value);
+
+    return depth && depth <= INT_MAX && acc_set_stack_depth(depth);
+
+}
+
+static int
+op_log(const char *value) {
+    return value && *value && acc_enable_memlog_to(value);
+
+}
+
+static int
+op_binlog(const char *value) {
+    return value && *value && acc_enable_binlog(value);
+
+}
+
+static int
+op_histograms(const char *value) {
+    int on = op_flag(value);
+
+    return on == 0 || (on == 1 && acc_enable_site_histograms());
+
+}
+
+static int
+op_report_histograms(const char *value) {
+    int on = op_flag(value);
+
+    if (on == 1)
+        acc_report_histograms_at_exit();
+
+    return on != -1;
+
+}
+
+static int
+op_report_profile(const char *value) {
+    int on = op_flag(value);
+
+    if (on == 1)
+        acc_report_profile_at_exit();
+
+    return on != -1;
+
+}
+
+/**
+ * Takes the number of groups to print, none for all of them, or 0 to leave
+ * leaks ungrouped.
+ */
+static int
+op_group_leaks(const char *value) {
+    size_t top = 0;
+
+    if (op_flag(value) == 0)
+        return 1;
+    if (value && (!(top = op_size(value)) || top > INT_MAX))
+        return 0;
+
+    acc_group_leaks(top);
+
+    return 1;
+
+}
+
+static int
+op_dump_on_signal(const char *value) {
+    return value && *value && acc_dump_on_signal(SIGUSR2, value);
+
+}
+
+static const struct option {
+    const char *name;
+    int (*set)(const char *value);
+
+} op_options[] = {
+    { "reentrant", op_reentrant },
+    { "shards", op_shards },
+    { "reserve", op_reserve },
+    { "lazy_text", op_lazy_text },
+    { "headers", op_headers },
+    { "sample", op_sample },
+    { "addr_index", op_addr_index },
+    { "stacks", op_stacks },
+    { "stack_depth", op_stack_depth },
+    { "log", op_log },
+    { "binlog", op_binlog },
+    { "histograms", op_histograms },
+    { "report_histograms", op_report_histograms },
+    { "report_profile", op_report_profile },
+    { "group_leaks", op_group_leaks },
+    { "dump_on_signal", op_dump_on_signal },
+    { NULL, NULL }
+
+};
+
+static void
+op_apply(const char *setting, size_t len) {
+    const struct option *opt;
+    char value[OP_MAXVALUE];
+    size_t namelen;
+    const char *eq;
+
+    eq = memchr(setting, '=', len);
+    namelen = eq ? (size_t)(eq - setting) : len;
+
+    for (opt = op_options; opt->name; opt ++)
+        if (strlen(opt->name) == namelen &&
+                !strncmp(opt->name, setting, namelen))
+            break;
+
+    if (opt->name && eq && len - namelen - 1 < sizeof(value)) {
+        memcpy(value, eq + 1, len - namelen - 1);
+        value[len - namelen - 1] = '\0';
+        if (opt->set(value))
+            return;
+    }
+    else if (opt->name && !eq && opt->set(NULL))
+        return;
+
+    fprintf(stderr, "libxmem: ignoring XMEM_OPTIONS setting `%.*s'\n",
+            (int)len, setting);
+
+}
+
+/**
+ * Applies XMEM_OPTIONS, the first time only: the preload library needs them
+ * before its first allocation, which comes before constructors run.
+ */
+void
+op_init(void) {
+    static int done;
+    const char *opts;
+
+    if (done)
+        return;
+    done = 1;
+
+    // Opening logs and loading the unwinder allocate on libxmem's behalf
+    pl_busy ++;
+    opts = getenv("XMEM_OPTIONS");
+    if (opts)
+        op_parse(opts);
+    pl_busy --;
+
+}
+
+void
+op_parse(const char *opts) {
+    size_t len;
+
+    while (*opts) {
+        len = strcspn(opts, ",");
+        if (len)
+            op_apply(opts, len);
+
+        opts += len;
+        if (*opts)
+            opts ++;
+    }
+
+}
+
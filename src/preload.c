@@ -0,0 +1,452 @@
+/**
+ * Copyright (c) 2014-2021, Ignacio Nin <nachex@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+
+#include <config.h>
+
+#include "preload.h"
+
+__thread int pl_busy __attribute__ (( tls_model("initial-exec") ));
+
+#if defined(XMEM_PRELOAD)
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <dlfcn.h>
+
+#include <account.h>
+
+#include "depot.h"
+#include "header.h"
+#include "options.h"
+
+/**
+ * The libc functions are looked up on the first call to any of them, and
+ * dlsym() may allocate while they are: those allocations come from a small
+ * static arena, and are never freed.
+ *
+ * Every block is accounted to the same site, and its text tells which
+ * function allocated it and where it was called from. Blocks libxmem
+ * doesn't know, allocated before it could see them or by libc behind its
+ * back, go straight to libc when freed or reallocated.
+ *
+ * Aligned allocations can't carry a header, so in header mode (and thus
+ * when sampling) they aren't accounted.
+ */
+
+#define PL_ARENA (64 * 1024)
+#define PL_ALIGN _Alignof(max_align_t)
+
+enum {
+    PL_UNRESOLVED,
+    PL_RESOLVING,
+    PL_READY,
+};
+
+static char pl_file[] = "libxmem-preload";
+
+static int pl_state;
+static char pl_arena[PL_ARENA] __attribute__ (( aligned(PL_ALIGN) ));
+static size_t pl_used;
+
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static void (*real_free)(void *);
+static int (*real_posix_memalign)(void **, size_t, size_t);
+static void *(*real_aligned_alloc)(size_t, size_t);
+static void *(*real_memalign)(size_t, size_t);
+static void *(*real_valloc)(size_t);
+static void *(*real_pvalloc)(size_t);
+static size_t (*real_malloc_usable_size)(void *);
+
+static void *
+pl_resolve(const char *name) {
+    static const char msg[] = "libxmem: can't find libc's allocator\n";
+    void *fn;
+
+    fn = dlsym(RTLD_NEXT, name);
+    if (!fn) {
+        // Nothing that allocates can be used yet
+        if (write(2, msg, sizeof(msg) - 1) < 0)
+            ;
+        abort();
+    }
+
+    return fn;
+
+}
+
+static void
+pl_init(void) {
+    pl_state = PL_RESOLVING;
+    real_malloc = pl_resolve("malloc");
+    real_calloc = pl_resolve("calloc");
+    real_realloc = pl_resolve("realloc");
+    real_free = pl_resolve("free");
+    real_posix_memalign = pl_resolve("posix_memalign");
+    real_aligned_alloc = pl_resolve("aligned_alloc");
+    real_memalign = pl_resolve("memalign");
+    real_valloc = pl_resolve("valloc");
+    real_pvalloc = pl_resolve("pvalloc");
+    real_malloc_usable_size = pl_resolve("malloc_usable_size");
+    pl_state = PL_READY;
+
+    // The interposed function stands between the program and libxmem
+    dp_skip ++;
+
+    // Any program may be threaded, and XMEM_OPTIONS must come before the
+    // first block
+    acc_set_reentrant();
+    acc_set_lazy_text();
+    op_init();
+
+}
+
+/**
+ * Returns 0 while the libc functions are being looked up.
+ */
+static inline int
+pl_ready(void) {
+    if (__builtin_expect(pl_state == PL_READY, 1))
+        return 1;
+    if (pl_state == PL_RESOLVING)
+        return 0;
+
+    pl_init();
+
+    return 1;
+
+}
+
+static void *
+pl_bootstrap(size_t sz) {
+    size_t *blk;
+
+    sz = (sz + PL_ALIGN - 1) & ~(PL_ALIGN - 1);
+    if (sz > PL_ARENA - PL_ALIGN - pl_used)
+        return NULL;
+
+    blk = (size_t *)(pl_arena + pl_used);
+    *blk = sz;
+    pl_used += PL_ALIGN + sz;
+
+    return (char *)blk + PL_ALIGN;
+
+}
+
+static inline int
+pl_in_arena(const void *ptr) {
+    return (const char *)ptr >= pl_arena &&
+        (const char *)ptr < pl_arena + PL_ARENA;
+
+}
+
+static inline size_t
+pl_arena_size(const void *ptr) {
+    return *(const size_t *)((const char *)ptr - PL_ALIGN);
+
+}
+
+static inline int
+pl_known(void *ptr) {
+    size_t sz;
+
+    return hd_lookup(ptr, &sz);
+
+}
+
+void *
+malloc(size_t sz) {
+    void *ret;
+
+    if (!pl_ready())
+        return pl_bootstrap(sz);
+    if (pl_busy)
+        return real_malloc(sz);
+
+    pl_busy ++;
+    ret = acc_malloc(sz, pl_file, 0, "%s from %p", "malloc",
+            __builtin_return_address(0));
+    pl_busy --;
+
+    return ret;
+
+}
+
+void *
+calloc(size_t n, size_t sz) {
+    void *ret;
+
+    if (sz && n > (size_t)-1 / sz) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if (!pl_ready())
+        return pl_bootstrap(n * sz);    // Never used, so still zeroed
+    if (pl_busy)
+        return real_calloc(n, sz);
+
+    pl_busy ++;
+    if (!hd_enabled) {
+        // Leaves libc to skip clearing memory fresh from the kernel
+        ret = real_calloc(n, sz);
+        if (ret)
+            acc_track(ret, n * sz, pl_file, 0, "%s from %p", "calloc",
+                    __builtin_return_address(0));
+    }
+    else {
+        ret = acc_malloc(n * sz, pl_file, 0, "%s from %p", "calloc",
+                __builtin_return_address(0));
+        if (ret)
+            memset(ret, 0, n * sz);
+    }
+    pl_busy --;
+
+    return ret;
+
+}
+
+void *
+realloc(void *ptr, size_t sz) {
+    void *ret;
+
+    if (!pl_ready()) {
+        ret = pl_bootstrap(sz);
+        if (ret && ptr)
+            memcpy(ret, ptr, pl_arena_size(ptr) < sz ? pl_arena_size(ptr) :
+                    sz);
+        return ret;
+    }
+
+    if (pl_in_arena(ptr)) {
+        ret = malloc(sz);
+        if (ret)
+            memcpy(ret, ptr, pl_arena_size(ptr) < sz ? pl_arena_size(ptr) :
+                    sz);
+        return ret;
+    }
+
+    if (pl_busy)
+        return real_realloc(ptr, sz);
+
+    pl_busy ++;
+    if (ptr && !pl_known(ptr))
+        ret = real_realloc(ptr, sz);
+    else
+        ret = acc_realloc(ptr, sz, pl_file, 0);
+    pl_busy --;
+
+    return ret;
+
+}
+
+void *
+reallocarray(void *ptr, size_t n, size_t sz) {
+    if (sz && n > (size_t)-1 / sz) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    return realloc(ptr, n * sz);
+
+}
+
+void
+free(void *ptr) {
+    if (!ptr || pl_in_arena(ptr) || !pl_ready())
+        return;
+
+    if (pl_busy) {
+        real_free(ptr);
+        return;
+    }
+
+    pl_busy ++;
+    if (pl_known(ptr))
+        acc_free(ptr, pl_file, 0);
+    else
+        real_free(ptr);
+    pl_busy --;
+
+}
+
+/**
+ * Accounts a block fresh from one of libc's aligned allocators.
+ */
+static inline __attribute__ (( always_inline )) void *
+pl_aligned(void *ptr, size_t sz, const char *fn, const void *caller) {
+    if (ptr) {
+        pl_busy ++;
+        acc_track(ptr, sz, pl_file, 0, "%s from %p", fn, caller);
+        pl_busy --;
+    }
+
+    return ptr;
+
+}
+
+int
+posix_memalign(void **ptr, size_t align, size_t sz) {
+    int ret;
+
+    if (!pl_ready()) {
+        if (align > PL_ALIGN)
+            return ENOMEM;
+        *ptr = pl_bootstrap(sz);
+        return *ptr ? 0 : ENOMEM;
+    }
+    if (pl_busy || hd_enabled)
+        return real_posix_memalign(ptr, align, sz);
+
+    ret = real_posix_memalign(ptr, align, sz);
+    if (!ret)
+        pl_aligned(*ptr, sz, "posix_memalign", __builtin_return_address(0));
+
+    return ret;
+
+}
+
+void *
+aligned_alloc(size_t align, size_t sz) {
+    if (!pl_ready())
+        return align <= PL_ALIGN ? pl_bootstrap(sz) : NULL;
+    if (pl_busy || hd_enabled)
+        return real_aligned_alloc(align, sz);
+
+    return pl_aligned(real_aligned_alloc(align, sz), sz, "aligned_alloc",
+            __builtin_return_address(0));
+
+}
+
+void *
+memalign(size_t align, size_t sz) {
+    if (!pl_ready())
+        return align <= PL_ALIGN ? pl_bootstrap(sz) : NULL;
+    if (pl_busy || hd_enabled)
+        return real_memalign(align, sz);
+
+    return pl_aligned(real_memalign(align, sz), sz, "memalign",
+            __builtin_return_address(0));
+
+}
+
+void *
+valloc(size_t sz) {
+    if (!pl_ready())
+        return NULL;
+    if (pl_busy || hd_enabled)
+        return real_valloc(sz);
+
+    return pl_aligned(real_valloc(sz), sz, "valloc",
+            __builtin_return_address(0));
+
+}
+
+void *
+pvalloc(size_t sz) {
+    if (!pl_ready())
+        return NULL;
+    if (pl_busy || hd_enabled)
+        return real_pvalloc(sz);
+
+    return pl_aligned(real_pvalloc(sz), sz, "pvalloc",
+            __builtin_return_address(0));
+
+}
+
+char *
+strdup(const char *str) {
+    char *ret;
+    size_t len;
+
+    if (pl_busy || !pl_ready()) {
+        len = strlen(str) + 1;
+        ret = malloc(len);
+        return ret ? memcpy(ret, str, len) : NULL;
+    }
+
+    pl_busy ++;
+    ret = acc_strdup(str, pl_file, 0);
+    pl_busy --;
+
+    return ret;
+
+}
+
+char *
+strndup(const char *str, size_t sz) {
+    char *ret;
+    size_t len;
+
+    if (pl_busy || !pl_ready()) {
+        len = strnlen(str, sz);
+        ret = malloc(len + 1);
+        if (!ret)
+            return NULL;
+        memcpy(ret, str, len);
+        ret[len] = '\0';
+        return ret;
+    }
+
+    pl_busy ++;
+    ret = acc_strndup(str, sz, pl_file, 0);
+    pl_busy --;
+
+    return ret;
+
+}
+
+/**
+ * With headers, libc's answer would come from the wrong place.
+ */
+size_t
+malloc_usable_size(void *ptr) {
+    size_t sz;
+
+    if (!ptr)
+        return 0;
+    if (pl_in_arena(ptr))
+        return pl_arena_size(ptr);
+    if (!pl_ready())
+        return 0;
+
+    if (!pl_busy && hd_enabled && hd_lookup(ptr, &sz))
+        return sz;
+
+    return real_malloc_usable_size(ptr);
+
+}
+
+#endif
+
@@ -0,0 +1,304 @@
+/**
+ * Copyright (c) 2014-2021, Ignacio Nin <nachex@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <config.h>
+
+#include "profile.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <pthread.h>
+
+#if XMEM_PROFILE
+
+/**
+ * Each thread counts into a block of its own, so timing doesn't add any
+ * contention of its own. Blocks are kept in a list for reporting; when a
+ * thread exits its block is handed to the next new thread, counts and all.
+ *
+ * Times are kept in ticks of pf_now(), which for the TSC are converted to
+ * nanoseconds only when reporting, against the clock's progress since the
+ * first operation. Histograms are log2: bucket n holds times below 2^n
+ * ticks.
+ */
+
+#define PF_BUCKETS 48
+
+enum pf_phase {
+    PF_TOTAL,
+    PF_IN_LIBC,
+    PF_BOOKKEEPING,
+    PF_LOCK_WAIT,
+    PF_PHASES,
+};
+
+static const char *pf_op_names[PF_OPS] = {
+    "malloc", "free", "realloc", "strdup", "check", "find"
+};
+
+static const char *pf_phase_names[PF_PHASES] = {
+    "total", "libc", "bookkeeping", "lock wait"
+};
+
+struct pf_counts {
+    unsigned long count[PF_OPS];
+    uint64_t sum[PF_OPS][PF_PHASES];
+    uint64_t max[PF_OPS][PF_PHASES];
+    unsigned long buckets[PF_OPS][PF_PHASES][PF_BUCKETS];
+
+    int unused;
+    struct pf_counts *next;
+
+};
+
+__thread uint64_t pf_waited __attribute__ (( tls_model("initial-exec") ));
+
+static __thread struct pf_counts *pf_mine
+    __attribute__ (( tls_model("initial-exec") ));
+
+static struct pf_counts *pf_all;
+static pthread_mutex_t pf_mx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t pf_key;
+static pthread_once_t pf_once = PTHREAD_ONCE_INIT;
+
+static uint64_t pf_start_ticks;
+static struct timespec pf_start_time;
+
+static void
+pf_thread_exit(void *arg) {
+    struct pf_counts *c = arg;
+
+    __atomic_store_n(&c->unused, 1, __ATOMIC_RELEASE);
+    pf_mine = NULL;
+
+}
+
+static void
+pf_init(void) {
+    pthread_key_create(&pf_key, pf_thread_exit);
+
+    clock_gettime(CLOCK_MONOTONIC, &pf_start_time);
+    pf_start_ticks = pf_now();
+
+}
+
+static struct pf_counts *
+pf_register(void) {
+    struct pf_counts *c;
+
+    pthread_once(&pf_once, pf_init);
+
+    pthread_mutex_lock(&pf_mx);
+    for (c = pf_all; c; c = c->next)
+        if (__atomic_load_n(&c->unused, __ATOMIC_ACQUIRE))
+            break;
+
+    if (c)
+        c->unused = 0;
+    else {
+        c = calloc(1, sizeof(struct pf_counts));
+        if (!c)
+            abort();
+        c->next = pf_all;
+        pf_all = c;
+    }
+    pthread_mutex_unlock(&pf_mx);
+
+    pthread_setspecific(pf_key, c);
+
+    return c;
+
+}
+
+/**
+ * Counts are only written by their thread, but may be read by a report at
+ * any time.
+ */
+static void
+pf_add(struct pf_counts *c, enum pf_op op, enum pf_phase phase,
+        uint64_t ticks)
+{
+    int bucket;
+
+    bucket = ticks ? 64 - __builtin_clzll(ticks) : 0;
+    if (bucket >= PF_BUCKETS)
+        bucket = PF_BUCKETS - 1;
+
+    __atomic_store_n(&c->sum[op][phase], c->sum[op][phase] + ticks,
+            __ATOMIC_RELAXED);
+    if (ticks > c->max[op][phase])
+        __atomic_store_n(&c->max[op][phase], ticks, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->buckets[op][phase][bucket],
+            c->buckets[op][phase][bucket] + 1, __ATOMIC_RELAXED);
+
+}
+
+void
+pf_record(const struct pf_timer *t, enum pf_op op) {
+    uint64_t total, other;
+    struct pf_counts *c;
+
+    total = pf_now() - t->start;
+
+    c = pf_mine;
+    if (!c)
+        c = pf_mine = pf_register();
+
+    // Clocks aren't precise enough for these to always add up
+    other = t->libc + pf_waited;
+    other = other < total ? total - other : 0;
+
+    __atomic_store_n(&c->count[op], c->count[op] + 1, __ATOMIC_RELAXED);
+    pf_add(c, op, PF_TOTAL, total);
+    pf_add(c, op, PF_IN_LIBC, t->libc);
+    pf_add(c, op, PF_BOOKKEEPING, other);
+    pf_add(c, op, PF_LOCK_WAIT, pf_waited);
+
+}
+
+/**
+ * Nanoseconds per tick, measured over at least 10ms.
+ */
+static double
+pf_tick_ns(void) {
+    struct timespec now;
+    uint64_t ticks;
+    double ns;
+
+    do {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        ticks = pf_now();
+        ns = (now.tv_sec - pf_start_time.tv_sec) * 1e9 +
+            (now.tv_nsec - pf_start_time.tv_nsec);
+    }
+    while (ns < 1e7);
+
+    return ticks > pf_start_ticks ? ns / (ticks - pf_start_ticks) : 1;
+
+}
+
+/**
+ * Returns the upper bound of the bucket the percentile falls in, but no more
+ * than the highest time seen.
+ */
+static double
+pf_percentile(const unsigned long *buckets, unsigned long count,
+        uint64_t max, double pct)
+{
+    unsigned long seen = 0, wanted;
+    int i;
+
+    wanted = count * pct / 100;
+    for (i = 0; i < PF_BUCKETS - 1; i ++) {
+        seen += buckets[i];
+        if (seen > wanted)
+            break;
+    }
+
+    return i < 64 && (1ULL << i) < max ? (double)(1ULL << i) : (double)max;
+
+}
+
+static void
+pf_print(FILE *out, const struct pf_counts *sum, int op, int phase,
+        double ns)
+{
+    const unsigned long *buckets = sum->buckets[op][phase];
+    unsigned long count = sum->count[op];
+    uint64_t max = sum->max[op][phase];
+
+    if (phase == PF_TOTAL)
+        fprintf(out, "%-8s %-12s %10lu", pf_op_names[op],
+                pf_phase_names[phase], count);
+    else
+        fprintf(out, "%-8s %-12s %10s", "", pf_phase_names[phase], "");
+
+    fprintf(out, " %8.0f %8.0f %8.0f %8.0f %10.0f\n",
+            sum->sum[op][phase] * ns / count,
+            pf_percentile(buckets, count, max, 50) * ns,
+            pf_percentile(buckets, count, max, 90) * ns,
+            pf_percentile(buckets, count, max, 99) * ns,
+            max * ns);
+
+}
+
+int
+pf_report(FILE *out) {
+    struct pf_counts sum, *c;
+    int op, phase, i;
+    double ns;
+
+    pthread_once(&pf_once, pf_init);
+    ns = pf_tick_ns();
+
+    pthread_mutex_lock(&pf_mx);
+    memset(&sum, 0, sizeof(struct pf_counts));
+    for (c = pf_all; c; c = c->next) {
+        for (op = 0; op < PF_OPS; op ++) {
+            sum.count[op] += __atomic_load_n(&c->count[op], __ATOMIC_RELAXED);
+            for (phase = 0; phase < PF_PHASES; phase ++) {
+                uint64_t max = __atomic_load_n(&c->max[op][phase],
+                        __ATOMIC_RELAXED);
+
+                sum.sum[op][phase] += __atomic_load_n(&c->sum[op][phase],
+                        __ATOMIC_RELAXED);
+                if (max > sum.max[op][phase])
+                    sum.max[op][phase] = max;
+                for (i = 0; i < PF_BUCKETS; i ++)
+                    sum.buckets[op][phase][i] += __atomic_load_n(
+                            &c->buckets[op][phase][i], __ATOMIC_RELAXED);
+            }
+        }
+    }
+    pthread_mutex_unlock(&pf_mx);
+
+    fprintf(out, "libxmem profile, in ns (percentiles are rounded up to a "
+            "power of two):\n");
+    fprintf(out, "%-8s %-12s %10s %8s %8s %8s %8s %10s\n", "", "",
+            "count", "mean", "p50", "p90", "p99", "max");
+
+    for (op = 0; op < PF_OPS; op ++)
+        if (sum.count[op])
+            for (phase = 0; phase < PF_PHASES; phase ++)
+                pf_print(out, &sum, op, phase, ns);
+
+    return 1;
+
+}
+
+#else
+
+int
+pf_report(FILE *out) {
+    return 0;
+
+}
+
+#endif
+
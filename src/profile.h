@@ -0,0 +1,121 @@
+/**
+ * Copyright (c) 2014-2021, Ignacio Nin <nachex@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if !defined(PROFILE_H)
+#define PROFILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/**
+ * Timing of libxmem's own entry points, split into time spent in libc,
+ * waiting for locks and everything else. Only built with
+ * --enable-profiling; otherwise the macros below expand to nothing (or to
+ * the bare expression) and nothing is timed.
+ *
+ * Entry points bracket their work with PF_BEGIN() and PF_END(), and wrap
+ * calls into libc with PF_LIBC(). Locks are taken with PF_LOCK(), which only
+ * starts a clock if trying the lock fails.
+ */
+
+enum pf_op {
+    PF_MALLOC,
+    PF_FREE,
+    PF_REALLOC,
+    PF_STRDUP,
+    PF_CHECK,
+    PF_FIND,
+    PF_OPS,
+};
+
+int pf_report(FILE *out);
+
+#if XMEM_PROFILE
+
+struct pf_timer {
+    uint64_t start;
+    uint64_t libc;
+
+};
+
+extern __thread uint64_t pf_waited
+    __attribute__ (( tls_model("initial-exec") ));
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+
+static inline uint64_t
+pf_now(void) {
+    return __rdtsc();
+
+}
+#else
+#include <time.h>
+
+static inline uint64_t
+pf_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+}
+#endif
+
+void pf_record(const struct pf_timer *t, enum pf_op op);
+
+#define PF_BEGIN(t) \
+    struct pf_timer t = { pf_now(), 0 }; \
+    pf_waited = 0
+#define PF_END(t, op) pf_record(&(t), op)
+#define PF_LIBC(t, expr) \
+    do { \
+        uint64_t pf_start = pf_now(); \
+        expr; \
+        (t).libc += pf_now() - pf_start; \
+    } while(0)
+#define PF_LOCK(trylock, lock) \
+    do { \
+        if (trylock) { \
+            uint64_t pf_start = pf_now(); \
+            lock; \
+            pf_waited += pf_now() - pf_start; \
+        } \
+    } while(0)
+
+#else
+
+#define PF_BEGIN(t)
+#define PF_END(t, op)
+#define PF_LIBC(t, expr) expr
+#define PF_LOCK(trylock, lock) lock
+
+#endif
+
+#endif
+
@@ -0,0 +1,490 @@
+/**
+ * Copyright (c) 2014-2021, Ignacio Nin <nachex@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+#include <account.h>
+
+#include "logread.h"
+#include "table.h"
+
+/**
+ * xmem-replay: replays the allocations recorded by xmem_enable_memlog() or
+ * xmem_enable_binlog(), either through libc or through libxmem, and reports
+ * throughput, per-operation latency and peak RSS. strdup() and strndup()
+ * are replayed as plain allocations of the same size.
+ *
+ * The log is first turned into a list of operations on numbered blocks, so
+ * that replaying doesn't depend on getting the same addresses back. With -t
+ * every thread of the original program (which only the binary log records)
+ * gets a thread replaying its operations; a thread freeing or reallocating
+ * a block allocated by another waits until that block exists.
+ */
+
+#define RP_NONE ((uint32_t)-1)
+
+enum rp_kind {
+    RP_MALLOC,
+    RP_FREE,
+    RP_REALLOC,
+    RP_KINDS,
+};
+
+static const char *rp_kind_names[RP_KINDS] = { "malloc", "free", "realloc" };
+
+struct rp_op {
+    uint64_t sz;
+    const char *file;
+    uint32_t line;
+    uint32_t slot;          // Block allocated, or freed by RP_FREE
+    uint32_t old;           // Block reallocated, or RP_NONE
+    uint8_t kind;
+
+};
+
+struct rp_thread {
+    uint32_t tid;
+    uint32_t *ops;
+    size_t nops;
+    pthread_t thread;
+
+};
+
+static struct rp_op *rp_ops;
+static size_t rp_nops;
+static uint32_t rp_nslots;
+
+static struct rp_thread *rp_threads;
+static size_t rp_nthreads;
+
+static void **rp_blocks;
+static uint32_t *rp_latency;
+
+static int rp_xmem;
+static pthread_barrier_t rp_start;
+
+static struct rp_thread *
+rp_thread_for(uint32_t tid) {
+    size_t i;
+
+    for (i = 0; i < rp_nthreads; i ++)
+        if (rp_threads[i].tid == tid)
+            return &rp_threads[i];
+
+    rp_threads = realloc(rp_threads,
+            (rp_nthreads + 1) * sizeof(struct rp_thread));
+    if (!rp_threads)
+        abort();
+    memset(&rp_threads[rp_nthreads], 0, sizeof(struct rp_thread));
+    rp_threads[rp_nthreads].tid = tid;
+
+    return &rp_threads[rp_nthreads++];
+
+}
+
+/**
+ * Table values are slot numbers plus one, since NULL means not found.
+ */
+static uint32_t
+rp_take(struct table *live, uint64_t ptr) {
+    void *val;
+
+    if (!ptr)
+        return RP_NONE;
+
+    val = tb_remove(live, (void *)(uintptr_t)ptr);
+
+    return val ? (uint32_t)((uintptr_t)val - 1) : RP_NONE;
+
+}
+
+static uint32_t
+rp_give(struct table *live, uint64_t ptr) {
+    uint32_t slot = rp_nslots++;
+
+    // A block that was never freed in the log, it's lost from now on
+    rp_take(live, ptr);
+    tb_insert(live, (void *)(uintptr_t)ptr, (void *)(uintptr_t)(slot + 1));
+
+    return slot;
+
+}
+
+/**
+ * Frees of blocks the log never saw allocated (because they were allocated
+ * before logging started) are dropped, and reallocations of those become
+ * allocations.
+ */
+static void
+rp_build(const struct lr_event *events, size_t nevents, int threaded) {
+    struct table live = TABLE_INITIALIZER;
+    struct rp_thread *t;
+    struct rp_op *op;
+    uint32_t *owner;
+    size_t i;
+
+    rp_ops = malloc((nevents ? nevents : 1) * sizeof(struct rp_op));
+    owner = malloc((nevents ? nevents : 1) * sizeof(uint32_t));
+    if (!rp_ops || !owner)
+        abort();
+
+    for (i = 0; i < nevents; i ++) {
+        const struct lr_event *e = &events[i];
+
+        op = &rp_ops[rp_nops];
+        op->sz = e->sz;
+        op->file = e->file;
+        op->line = e->line;
+        op->old = RP_NONE;
+
+        switch (e->op) {
+        case BL_MALLOC:
+        case BL_STRDUP:
+        case BL_STRNDUP:
+            op->kind = RP_MALLOC;
+            op->slot = rp_give(&live, e->ptr);
+            break;
+        case BL_FREE:
+            op->kind = RP_FREE;
+            op->slot = rp_take(&live, e->ptr);
+            if (op->slot == RP_NONE)
+                continue;
+            break;
+        case BL_REALLOC:
+            op->kind = RP_REALLOC;
+            op->old = rp_take(&live, e->old);
+            op->slot = rp_give(&live, e->ptr);
+            break;
+        default:
+            continue;
+        }
+
+        t = rp_thread_for(threaded ? e->tid : 0);
+        owner[rp_nops] = t - rp_threads;
+        t->nops ++;
+        rp_nops ++;
+    }
+
+    for (i = 0; i < rp_nthreads; i ++) {
+        rp_threads[i].ops = malloc((rp_threads[i].nops + 1) *
+                sizeof(uint32_t));
+        if (!rp_threads[i].ops)
+            abort();
+        rp_threads[i].nops = 0;
+    }
+    for (i = 0; i < rp_nops; i ++) {
+        t = &rp_threads[owner[i]];
+        t->ops[t->nops++] = i;
+    }
+
+    free(owner);
+    tb_destroy(&live);
+
+}
+
+static uint64_t
+rp_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+}
+
+/**
+ * Waits for a block allocated by another thread.
+ */
+static void *
+rp_block(uint32_t slot) {
+    void *ptr;
+
+    while (!(ptr = __atomic_load_n(&rp_blocks[slot], __ATOMIC_ACQUIRE)))
+        sched_yield();
+
+    return ptr;
+
+}
+
+static void *
+rp_run(void *arg) {
+    struct rp_thread *t = arg;
+    uint64_t start, end;
+    size_t i;
+
+    pthread_barrier_wait(&rp_start);
+
+    for (i = 0; i < t->nops; i ++) {
+        const struct rp_op *op = &rp_ops[t->ops[i]];
+        char *file = (char *)op->file;
+        void *ptr = NULL, *old = NULL;
+
+        if (op->kind == RP_FREE)
+            old = rp_block(op->slot);
+        else if (op->old != RP_NONE)
+            old = rp_block(op->old);
+
+        start = rp_now();
+        switch (op->kind) {
+        case RP_MALLOC:
+            ptr = rp_xmem ? acc_malloc(op->sz, file, op->line, "replayed") :
+                malloc(op->sz);
+            break;
+        case RP_FREE:
+            if (rp_xmem)
+                acc_free(old, file, op->line);
+            else
+                free(old);
+            break;
+        case RP_REALLOC:
+            ptr = rp_xmem ? acc_realloc(old, op->sz, file, op->line) :
+                realloc(old, op->sz);
+            break;
+        }
+        end = rp_now();
+
+        rp_latency[t->ops[i]] = end - start > UINT32_MAX ? UINT32_MAX :
+            end - start;
+
+        if (op->kind == RP_FREE) {
+            rp_blocks[op->slot] = NULL;
+            continue;
+        }
+        if (!ptr) {
+            fprintf(stderr, "Out of memory allocating %lu bytes\n",
+                    (unsigned long)op->sz);
+            exit(1);
+        }
+        if (op->old != RP_NONE)
+            rp_blocks[op->old] = NULL;
+        __atomic_store_n(&rp_blocks[op->slot], ptr, __ATOMIC_RELEASE);
+    }
+
+    return NULL;
+
+}
+
+static int
+rp_compare(const void *a, const void *b) {
+    uint32_t la = *(const uint32_t *)a, lb = *(const uint32_t *)b;
+
+    return la < lb ? -1 : la > lb;
+
+}
+
+static void
+rp_report_latency(void) {
+    static const double pcts[] = { 50, 90, 99, 99.9 };
+    uint32_t *lat;
+    size_t i, j, n;
+    int kind;
+
+    lat = malloc((rp_nops ? rp_nops : 1) * sizeof(uint32_t));
+    if (!lat)
+        abort();
+
+    printf("%-8s %10s %8s %8s %8s %8s %10s\n", "latency", "count", "p50",
+            "p90", "p99", "p99.9", "max (ns)");
+
+    for (kind = 0; kind < RP_KINDS; kind ++) {
+        for (i = n = 0; i < rp_nops; i ++)
+            if (rp_ops[i].kind == kind)
+                lat[n++] = rp_latency[i];
+        if (!n)
+            continue;
+
+        qsort(lat, n, sizeof(uint32_t), rp_compare);
+
+        printf("%-8s %10lu", rp_kind_names[kind], (unsigned long)n);
+        for (j = 0; j < sizeof(pcts) / sizeof(pcts[0]); j ++)
+            printf(" %8u", lat[(size_t)(pcts[j] / 100 * (n - 1))]);
+        printf(" %10u\n", lat[n - 1]);
+    }
+
+    free(lat);
+
+}
+
+/**
+ * Reads a memory figure, in kB, from /proc/self/status.
+ */
+static long
+rp_status(const char *field) {
+    char line[256];
+    size_t len = strlen(field);
+    long ret = -1;
+    FILE *f;
+
+    f = fopen("/proc/self/status", "r");
+    if (!f)
+        return -1;
+
+    while (ret == -1 && fgets(line, sizeof(line), f))
+        if (!strncmp(line, field, len) && line[len] == ':')
+            ret = strtol(line + len + 1, NULL, 10);
+    fclose(f);
+
+    return ret;
+
+}
+
+/**
+ * Loading the log takes far more memory than replaying it, so the peak is
+ * reset (which Linux allows through clear_refs) before replaying. Returns 0
+ * if it can't be, and the peak will include loading.
+ */
+static int
+rp_reset_peak(void) {
+    FILE *f;
+    int ret;
+
+    f = fopen("/proc/self/clear_refs", "w");
+    if (!f)
+        return 0;
+
+    ret = fputs("5", f) >= 0;
+    ret = !fclose(f) && ret;
+
+    return ret;
+
+}
+
+static long
+rp_peak(void) {
+    struct rusage ru;
+    long ret;
+
+    ret = rp_status("VmHWM");
+    if (ret != -1)
+        return ret;
+
+    getrusage(RUSAGE_SELF, &ru);
+
+    return ru.ru_maxrss;
+
+}
+
+static void
+usage(const char *name) {
+    fprintf(stderr, "Syntax: %s [-x] [-t] memory.log\n"
+            "  -x  allocate through libxmem instead of libc\n"
+            "  -t  replay each thread of the log in its own thread\n",
+            name);
+
+}
+
+int
+main(int argc, char *argv[]) {
+    struct lr_event *events;
+    size_t nevents, i;
+    uint64_t start, elapsed;
+    long rss;
+    int threaded = 0, reset, c;
+
+    while ((c = getopt(argc, argv, "xt")) != -1) {
+        switch (c) {
+        case 'x':
+            rp_xmem = 1;
+            break;
+        case 't':
+            threaded = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (!lr_load(argv[optind], &events, &nevents))
+        return 1;
+    rp_build(events, nevents, threaded);
+    free(events);
+
+    rp_blocks = calloc(rp_nslots ? rp_nslots : 1, sizeof(void *));
+    rp_latency = calloc(rp_nops ? rp_nops : 1, sizeof(uint32_t));
+    if (!rp_blocks || !rp_latency)
+        abort();
+
+    if (rp_xmem && rp_nthreads > 1)
+        acc_set_reentrant();
+
+    rss = rp_status("VmRSS");
+    reset = rp_reset_peak();
+
+    pthread_barrier_init(&rp_start, NULL, rp_nthreads + 1);
+    for (i = 0; i < rp_nthreads; i ++)
+        if (pthread_create(&rp_threads[i].thread, NULL, rp_run,
+                    &rp_threads[i])) {
+            perror("pthread_create");
+            return 1;
+        }
+
+    pthread_barrier_wait(&rp_start);
+    start = rp_now();
+    for (i = 0; i < rp_nthreads; i ++)
+        pthread_join(rp_threads[i].thread, NULL);
+    elapsed = rp_now() - start;
+
+    printf("%lu operations on %lu blocks in %lu %s through %s\n",
+            (unsigned long)rp_nops, (unsigned long)rp_nslots,
+            (unsigned long)rp_nthreads,
+            rp_nthreads == 1 ? "thread" : "threads",
+            rp_xmem ? "libxmem" : "libc");
+    printf("elapsed %.3f s, %.0f operations/s\n", elapsed / 1e9,
+            elapsed ? rp_nops / (elapsed / 1e9) : 0.0);
+    rp_report_latency();
+    printf("peak RSS %ld kB%s (%ld kB before replaying)\n", rp_peak(),
+            reset ? "" : " including loading the log", rss);
+
+    // Blocks the log never freed, so libxmem doesn't report them on exit
+    for (i = 0; i < rp_nslots; i ++) {
+        if (!rp_blocks[i])
+            continue;
+        if (rp_xmem)
+            acc_free(rp_blocks[i], __FILE__, __LINE__);
+        else
+            free(rp_blocks[i]);
+    }
+
+    return 0;
+
+}
+
@@ -0,0 +1,489 @@
+/**
+ * Copyright (c) 2014-2021, Ignacio Nin <nachex@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <config.h>
+
+#include "report.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <unistd.h>
+
+#include "depot.h"
+#include "format.h"
+#include "store.h"
+#include "uthash.h"
+
+/**
+ * Groups are keyed by site and stack, and keep the text of the first block
+ * found as an example. The store is walked once to build them, and they're
+ * sorted and printed once it's unlocked.
+ */
+
+#define RP_EXAMPLE 80
+
+/**
+ * Heap dumps are written from a child forked off a threaded process, where
+ * stdio and malloc() may be left locked for good: they're put together by
+ * hand in a buffer of their own, and written out with write().
+ */
+
+#define RP_DUMPBUFFER 4096
+
+struct rp_dump {
+    int fd;
+    int failed;
+
+    size_t len;
+    char buf[RP_DUMPBUFFER];
+
+};
+
+struct rp_key {
+    const char *file;
+    int line;
+    uint32_t stack;
+
+};
+
+struct rp_group {
+    struct rp_key key;
+
+    unsigned long blocks;
+    size_t bytes;
+    char example[RP_EXAMPLE];
+
+    UT_hash_handle hh;
+
+};
+
+struct rp_walk {
+    uint32_t since;
+    void *arg;
+
+};
+
+struct rp_collect {
+    struct xmem_stack_stats *stats;
+    size_t count;
+    size_t size;
+
+};
+
+struct rp_stacks {
+    uint32_t since;
+
+    unsigned long *blocks;
+    size_t *bytes;
+    uint32_t count;
+
+};
+
+static int
+rp_count_block(const struct as_block *block, void *arg) {
+    struct rp_walk *walk = arg;
+
+    if (block->epoch >= walk->since)
+        (*(int *)walk->arg) ++;
+
+    return 0;
+
+}
+
+int
+rp_count(uint32_t since) {
+    struct rp_walk walk;
+    int count = 0;
+
+    if (!since)
+        return as_count();
+
+    walk.since = since;
+    walk.arg = &count;
+    as_walk(rp_count_block, &walk);
+
+    return count;
+
+}
+
+static int
+rp_count_stack(const struct as_block *block, void *arg) {
+    struct rp_stacks *stacks = arg;
+
+    if (block->epoch < stacks->since)
+        return 0;
+
+    if (block->stack && block->stack < stacks->count) {
+        stacks->blocks[block->stack] += block->weight;
+        stacks->bytes[block->stack] += block->sz * block->weight;
+    }
+
+    return 0;
+
+}
+
+/**
+ * Blocks are counted by stack while walking the store, and reported once
+ * it's unlocked, so the callback is free to allocate.
+ */
+int
+rp_stack_stats(int (*callback)(const struct xmem_stack_stats *stats,
+            void *arg), void *arg, uint32_t since)
+{
+    struct xmem_stack_stats stats;
+    struct rp_stacks stacks;
+    uint32_t id;
+    int ret = 0;
+
+    stacks.since = since;
+    stacks.count = dp_count();
+    stacks.blocks = calloc(stacks.count, sizeof(unsigned long));
+    stacks.bytes = calloc(stacks.count, sizeof(size_t));
+    if (!stacks.blocks || !stacks.bytes)
+        abort();
+
+    as_walk(rp_count_stack, &stacks);
+
+    for (id = 1; id < stacks.count && !ret; id ++) {
+        if (!stacks.blocks[id])
+            continue;
+
+        stats.id = id;
+        stats.depth = dp_frames(id, &stats.frames);
+        stats.blocks = stacks.blocks[id];
+        stats.bytes = stacks.bytes[id];
+        ret = callback(&stats, arg);
+    }
+
+    free(stacks.blocks);
+    free(stacks.bytes);
+
+    return ret;
+
+}
+
+static int
+rp_print_block(const struct as_block *block, void *arg) {
+    struct rp_walk *walk = arg;
+    FILE *out = walk->arg;
+
+    if (block->epoch < walk->since)
+        return 0;
+
+    fprintf(out, "- %lu bytes allocated in %s, line %d: txt `%s'",
+            block->sz, block->file, block->line, block->txt);
+    if (block->stack)
+        fprintf(out, ", stack #%u", block->stack);
+    fprintf(out, "\n");
+
+    return 0;
+
+}
+
+/**
+ * Stacks captured after the array was sized don't fit, and are left out.
+ */
+static int
+rp_collect_stack(const struct xmem_stack_stats *stats, void *arg) {
+    struct rp_collect *collect = arg;
+
+    if (collect->count == collect->size)
+        return 1;
+    collect->stats[collect->count ++] = *stats;
+
+    return 0;
+
+}
+
+static int
+rp_compare_stacks(const void *a, const void *b) {
+    const struct xmem_stack_stats *sa = a, *sb = b;
+
+    return sa->bytes < sb->bytes ? 1 : sa->bytes > sb->bytes ? -1 :
+        sa->id < sb->id ? -1 : sa->id > sb->id;
+
+}
+
+/**
+ * The blocks left grouped by allocation stack, the heaviest first.
+ */
+static void
+rp_stacks(FILE *out, uint32_t since) {
+    struct xmem_stack_stats *stacks;
+    struct rp_collect collect;
+    size_t i;
+
+    collect.size = dp_count();
+    collect.count = 0;
+    collect.stats = stacks = calloc(collect.size,
+            sizeof(struct xmem_stack_stats));
+    if (!stacks)
+        return;
+
+    rp_stack_stats(rp_collect_stack, &collect, since);
+    qsort(stacks, collect.count, sizeof(struct xmem_stack_stats),
+            rp_compare_stacks);
+
+    if (collect.count)
+        fprintf(out, "Blocks left by allocation stack:\n");
+    for (i = 0; i < collect.count; i ++) {
+        fprintf(out, "- %lu %s, %lu bytes allocated from stack #%u:\n",
+                stacks[i].blocks, stacks[i].blocks == 1 ? "block" : "blocks",
+                (unsigned long)stacks[i].bytes, stacks[i].id);
+        dp_print(out, stacks[i].id, "    ");
+    }
+    free(stacks);
+
+}
+
+void
+rp_blocks(FILE *out, uint32_t since) {
+    struct rp_walk walk;
+
+    walk.since = since;
+    walk.arg = out;
+    as_walk(rp_print_block, &walk);
+    if (dp_enabled)
+        rp_stacks(out, since);
+
+}
+
+static int
+rp_group_block(const struct as_block *block, void *arg) {
+    struct rp_walk *walk = arg;
+    struct rp_group **groups = walk->arg, *g;
+    struct rp_key key;
+
+    if (block->epoch < walk->since)
+        return 0;
+
+    // Zeroed padding, since the whole key is hashed
+    memset(&key, 0, sizeof(struct rp_key));
+    key.file = block->file;
+    key.line = block->line;
+    key.stack = block->stack;
+
+    HASH_FIND(hh, *groups, &key, sizeof(struct rp_key), g);
+    if (!g) {
+        g = calloc(1, sizeof(struct rp_group));
+        if (!g)
+            abort();
+        g->key = key;
+        strncpy(g->example, block->txt, RP_EXAMPLE - 1);
+        HASH_ADD(hh, *groups, key, sizeof(struct rp_key), g);
+    }
+
+    g->blocks += block->weight;
+    g->bytes += block->sz * block->weight;
+
+    return 0;
+
+}
+
+static int
+rp_compare_groups(const void *a, const void *b) {
+    const struct rp_group *ga = *(struct rp_group * const *)a;
+    const struct rp_group *gb = *(struct rp_group * const *)b;
+    int c;
+
+    if (ga->bytes != gb->bytes)
+        return ga->bytes < gb->bytes ? 1 : -1;
+
+    c = strcmp(ga->key.file, gb->key.file);
+    if (c)
+        return c;
+    if (ga->key.line != gb->key.line)
+        return ga->key.line < gb->key.line ? -1 : 1;
+
+    return ga->key.stack < gb->key.stack ? -1 : ga->key.stack > gb->key.stack;
+
+}
+
+/**
+ * Prints the top groups by bytes, or all of them if top is 0, and sums up
+ * the rest in one line.
+ */
+void
+rp_grouped(FILE *out, int top, uint32_t since) {
+    struct rp_group *groups = NULL, *g, *tmp, **sorted;
+    struct rp_walk walk;
+    unsigned long rest_blocks = 0;
+    size_t n, i, rest_bytes = 0;
+
+    walk.since = since;
+    walk.arg = &groups;
+    as_walk(rp_group_block, &walk);
+
+    n = HASH_COUNT(groups);
+    sorted = malloc(n * sizeof(struct rp_group *));
+    if (!sorted)
+        abort();
+    i = 0;
+    HASH_ITER(hh, groups, g, tmp)
+        sorted[i++] = g;
+    qsort(sorted, n, sizeof(struct rp_group *), rp_compare_groups);
+
+    for (i = 0; i < n; i ++) {
+        g = sorted[i];
+        if (top && i >= top) {
+            rest_blocks += g->blocks;
+            rest_bytes += g->bytes;
+            continue;
+        }
+
+        fprintf(out, "- %lu bytes in %lu %s allocated in %s, line %d, "
+                "e.g. `%s'", (unsigned long)g->bytes, g->blocks,
+                g->blocks == 1 ? "block" : "blocks", g->key.file, g->key.line,
+                g->example);
+        if (g->key.stack) {
+            fprintf(out, ", from stack #%u:\n", g->key.stack);
+            dp_print(out, g->key.stack, "    ");
+        }
+        else
+            fprintf(out, "\n");
+    }
+
+    if (top && n > top)
+        fprintf(out, "- %lu bytes in %lu %s in %lu more %s\n",
+                (unsigned long)rest_bytes, rest_blocks,
+                rest_blocks == 1 ? "block" : "blocks", (unsigned long)n - top,
+                n - top == 1 ? "group" : "groups");
+
+    HASH_ITER(hh, groups, g, tmp) {
+        HASH_DEL(groups, g);
+        free(g);
+    }
+    free(sorted);
+
+}
+
+static void
+rp_flush(struct rp_dump *dump) {
+    size_t off = 0;
+    ssize_t n;
+
+    while (off < dump->len && !dump->failed) {
+        n = write(dump->fd, dump->buf + off, dump->len - off);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            dump->failed = 1;
+        else
+            off += n;
+    }
+    dump->len = 0;
+
+}
+
+static void
+rp_put(struct rp_dump *dump, const char *s, size_t len) {
+    size_t n;
+
+    while (len) {
+        if (dump->len == sizeof(dump->buf))
+            rp_flush(dump);
+
+        n = sizeof(dump->buf) - dump->len;
+        if (n > len)
+            n = len;
+        memcpy(dump->buf + dump->len, s, n);
+        dump->len += n;
+        s += n;
+        len -= n;
+    }
+
+}
+
+static void
+rp_puts(struct rp_dump *dump, const char *s) {
+    rp_put(dump, s, strlen(s));
+
+}
+
+static void
+rp_putnum(struct rp_dump *dump, unsigned long n) {
+    char digits[FM_ULONGDIGITS];
+
+    rp_put(dump, digits, fm_ulong(digits, n));
+
+}
+
+static int
+rp_dump_block(const struct as_block *block, void *arg) {
+    struct rp_dump *dump = arg;
+
+    rp_puts(dump, "- ");
+    rp_putnum(dump, block->sz);
+    rp_puts(dump, " bytes allocated in ");
+    rp_puts(dump, block->file);
+    rp_puts(dump, ", line ");
+    rp_putnum(dump, block->line);
+    rp_puts(dump, ": txt `");
+    if (block->txt)
+        rp_puts(dump, block->txt);
+    rp_puts(dump, "'");
+    if (block->stack) {
+        rp_puts(dump, ", stack #");
+        rp_putnum(dump, block->stack);
+    }
+    rp_puts(dump, "\n");
+
+    return 0;
+
+}
+
+/**
+ * Writes every block to fd, laid out like rp_blocks(), for a child left by
+ * as_fork(). Stacks are given by number only, and deferred texts as their
+ * format, since symbolizing and rendering allocate. Returns 0 if the dump
+ * couldn't be written in full.
+ */
+int
+rp_dump(int fd, int pid) {
+    struct rp_dump dump;
+    int count;
+
+    dump.fd = fd;
+    dump.failed = 0;
+    dump.len = 0;
+
+    count = rp_count(0);
+    rp_putnum(&dump, count);
+    rp_puts(&dump, count == 1 ? " allocated block exists" :
+            " allocated blocks exist");
+    rp_puts(&dump, " in process ");
+    rp_putnum(&dump, pid);
+    rp_puts(&dump, ":\n");
+
+    as_walk_unrendered(rp_dump_block, &dump);
+    rp_flush(&dump);
+
+    return !dump.failed;
+
+}
@@ -0,0 +1,116 @@
+/**
+ * Copyright (c) 2014-2021, Ignacio Nin <nachex@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <config.h>
+
+#include "sample.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+
+/**
+ * Each thread counts down the bytes left until its next sample, and the
+ * block that reaches zero is sampled. The distances between samples are
+ * drawn from an exponential distribution of mean sm_rate, which makes
+ * sampling a Poisson process over the bytes allocated: a block of sz bytes
+ * is sampled with probability 1 - exp(-sz / sm_rate), whatever else was
+ * allocated before it. Weighting each sample by the inverse of that
+ * probability makes the sums of weights unbiased estimates. Weights are
+ * whole numbers, so the inverse is rounded up or down at random, up with a
+ * probability of its fractional part, which keeps it right on average.
+ */
+
+size_t sm_rate;
+
+static __thread size_t sm_left __attribute__ (( tls_model("initial-exec") ));
+static __thread uint64_t sm_state
+    __attribute__ (( tls_model("initial-exec") ));
+
+void
+sm_set_rate(size_t rate) {
+    sm_rate = rate;
+
+}
+
+/**
+ * xorshift64*, seeded per thread from the address of its state and the
+ * time.
+ */
+static double
+sm_uniform(void) {
+    uint64_t x = sm_state;
+
+    if (!x)
+        x = (uint64_t)(uintptr_t)&sm_state ^ (uint64_t)time(NULL) ^
+            0x9e3779b97f4a7c15ULL;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    sm_state = x;
+
+    // In (0, 1], so the logarithm below stays finite
+    return (((x * 0x2545f4914f6cdd1dULL) >> 11) + 1) * 0x1.0p-53;
+
+}
+
+static size_t
+sm_distance(void) {
+    return -log(sm_uniform()) * sm_rate + 1;
+
+}
+
+/**
+ * Returns the weight of the block if it's sampled, or 0 if it isn't.
+ */
+unsigned long
+sm_sample(size_t sz) {
+    unsigned long weight;
+    double p, w;
+
+    if (!sm_left)
+        sm_left = sm_distance();
+
+    if (sz < sm_left) {
+        sm_left -= sz;
+        return 0;
+    }
+
+    sm_left = sm_distance();
+
+    p = -expm1(-(double)sz / sm_rate);
+    w = 1 / p;
+    weight = w;
+    if (sm_uniform() <= w - weight)
+        weight ++;
+
+    return weight;
+
+}
+
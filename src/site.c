@@ -0,0 +1,470 @@
+/**
+ * Copyright (c) 2014-2021, Ignacio Nin <nachex@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <config.h>
+
+#include "site.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#include "profile.h"
+#include "slab.h"
+
+/**
+ * Sites are found through a fixed hash of chains which are only ever
+ * prepended to, so lookups need no lock; adding a site takes one. File names
+ * must be interned, so the address identifies the file.
+ *
+ * Most statistics are not updated in the site on every operation, which
+ * would have all threads allocating at a busy site fight over its cache
+ * line. Instead each thread keeps pending counts for the sites it used last
+ * and adds them to the site every SI_BATCH operations, when the entry is
+ * needed for another site, on thread exit and when walking the sites.
+ *
+ * Allocations are the exception: they're added to the site's allocations
+ * and live bytes at once, and raise its peak there and then. A block may be
+ * freed by another thread than the one allocating it, and its free flushed
+ * first, so batching allocations could take the live counts below zero and
+ * miss the peak. As it is, live counts and the peak may be over by the
+ * frees other threads have pending, never under.
+ *
+ * Pending counts are also kept by size class, for a handful of classes per
+ * site (most sites allocate one or two sizes); a site using more than that
+ * is flushed whenever a new class comes along. Flushing adds them to the
+ * process-wide histogram and, if enabled, to the site's own.
+ */
+
+#define SI_BUCKETS 4096
+#define SI_CACHE 64
+#define SI_BATCH 256
+#define SI_CLASSES 4
+
+struct pending {
+    struct site *site;
+
+    unsigned long frees;
+    size_t total;
+    size_t freed;
+    unsigned ops;
+
+    int nclasses;
+    unsigned char classes[SI_CLASSES];
+    unsigned long class_allocs[SI_CLASSES];
+    unsigned long class_frees[SI_CLASSES];
+
+};
+
+static struct site *si_buckets[SI_BUCKETS];
+static struct slab si_sites = SLAB_INITIALIZER(struct site);
+static int si_used;
+
+static struct sizes si_totals __attribute__ (( aligned(64) ));
+static int si_sizes;
+
+static __thread struct pending *si_pending
+        __attribute__ (( tls_model("initial-exec") ));
+static pthread_key_t si_key;
+static pthread_once_t si_once = PTHREAD_ONCE_INIT;
+
+int si_reentrant;
+pthread_mutex_t site_mx = PTHREAD_MUTEX_INITIALIZER;
+
+#define LOCK() \
+    do { \
+        if (si_reentrant) \
+            PF_LOCK(pthread_mutex_trylock(&site_mx), \
+                    pthread_mutex_lock(&site_mx)); \
+    } while(0)
+#define UNLOCK() \
+    do { \
+        if (si_reentrant) \
+            pthread_mutex_unlock(&site_mx); \
+    } while(0)
+
+void
+si_set_reentrant(void) {
+    si_reentrant = 1;
+
+}
+
+/**
+ * Per-site histograms can only be enabled before the first site is created,
+ * so that every site has one.
+ */
+int
+si_enable_sizes(void) {
+    LOCK();
+    if (!si_used)
+        si_sizes = 1;
+    UNLOCK();
+
+    return si_sizes;
+
+}
+
+static unsigned
+si_hash(const char *file, int line) {
+    unsigned long long h = (unsigned long long)(size_t)file ^
+        (unsigned long long)line << 40;
+
+    return (h * 0x9e3779b97f4a7c15ULL) >> 52 & (SI_BUCKETS - 1);
+
+}
+
+static struct site *
+si_search(struct site *s, const char *file, int line) {
+    for (; s; s = s->next)
+        if (s->file == file && s->line == line)
+            break;
+
+    return s;
+
+}
+
+struct site *
+si_get(const char *file, int line) {
+    struct site **bucket = &si_buckets[si_hash(file, line)];
+    struct site *s;
+
+    s = si_search(__atomic_load_n(bucket, __ATOMIC_ACQUIRE), file, line);
+    if (s)
+        return s;
+
+    LOCK();
+    // Somebody may have added it in the meantime
+    s = si_search(*bucket, file, line);
+    if (!s) {
+        s = sl_alloc(&si_sites);
+        memset(s, 0, sizeof(struct site));
+        s->file = file;
+        s->line = line;
+        if (si_sizes && !(s->sizes = calloc(1, sizeof(struct sizes))))
+            abort();
+        s->next = *bucket;
+        si_used = 1;
+        __atomic_store_n(bucket, s, __ATOMIC_RELEASE);
+    }
+    UNLOCK();
+
+    return s;
+
+}
+
+static void
+si_add_sizes(struct sizes *sizes, int cls, unsigned long allocs,
+        unsigned long frees)
+{
+    if (allocs)
+        __atomic_add_fetch(&sizes->allocs[cls], allocs, __ATOMIC_RELAXED);
+    if (frees)
+        __atomic_add_fetch(&sizes->frees[cls], frees, __ATOMIC_RELAXED);
+
+}
+
+static void
+si_flush(struct pending *p) {
+    struct site *s = p->site;
+    int i;
+
+    for (i = 0; i < p->nclasses; i ++) {
+        si_add_sizes(&si_totals, p->classes[i], p->class_allocs[i],
+                p->class_frees[i]);
+        if (s->sizes)
+            si_add_sizes(s->sizes, p->classes[i], p->class_allocs[i],
+                    p->class_frees[i]);
+    }
+
+    __atomic_add_fetch(&s->frees, p->frees, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&s->total_bytes, p->total, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&s->live_bytes, p->freed, __ATOMIC_RELAXED);
+
+    memset(p, 0, sizeof(struct pending));
+    p->site = s;
+
+}
+
+static void
+si_flush_all(struct pending *pending) {
+    int i;
+
+    for (i = 0; i < SI_CACHE; i ++)
+        if (pending[i].site)
+            si_flush(&pending[i]);
+
+}
+
+static void
+si_thread_exit(void *arg) {
+    si_flush_all(arg);
+    free(arg);
+    si_pending = NULL;
+
+}
+
+static void
+si_make_key(void) {
+    pthread_key_create(&si_key, si_thread_exit);
+
+}
+
+/**
+ * Returns the index of the pending counts for the size class of sz.
+ */
+static int
+si_pending_class(struct pending *p, size_t sz) {
+    int cls = si_class(sz);
+    int i;
+
+    for (i = 0; i < p->nclasses; i ++)
+        if (p->classes[i] == cls)
+            return i;
+
+    if (p->nclasses == SI_CLASSES)
+        si_flush(p);
+
+    i = p->nclasses++;
+    p->classes[i] = cls;
+    p->class_allocs[i] = p->class_frees[i] = 0;
+
+    return i;
+
+}
+
+static struct pending *
+si_entry(struct site *s) {
+    struct pending *p;
+
+    if (!si_pending) {
+        si_pending = calloc(SI_CACHE, sizeof(struct pending));
+        if (!si_pending)
+            abort();
+        pthread_once(&si_once, si_make_key);
+        pthread_setspecific(si_key, si_pending);
+    }
+
+    // Sites are allocated next to each other, so consecutive ones don't clash
+    p = &si_pending[(size_t)s / sizeof(struct site) % SI_CACHE];
+    if (p->site != s) {
+        if (p->site)
+            si_flush(p);
+        p->site = s;
+    }
+
+    return p;
+
+}
+
+/**
+ * A block of weight w counts as w blocks of its size.
+ */
+void
+si_alloc(struct site *s, size_t sz, unsigned long w) {
+    struct pending *p = si_entry(s);
+    size_t live, peak;
+
+    __atomic_add_fetch(&s->allocs, w, __ATOMIC_RELAXED);
+    live = __atomic_add_fetch(&s->live_bytes, sz * w, __ATOMIC_RELAXED);
+    peak = __atomic_load_n(&s->peak_bytes, __ATOMIC_RELAXED);
+    while (live > peak && !__atomic_compare_exchange_n(&s->peak_bytes, &peak,
+                live, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+
+    p->class_allocs[si_pending_class(p, sz)] += w;
+    p->total += sz * w;
+
+    if (++p->ops == SI_BATCH)
+        si_flush(p);
+
+}
+
+void
+si_free(struct site *s, size_t sz, unsigned long w) {
+    struct pending *p = si_entry(s);
+
+    p->class_frees[si_pending_class(p, sz)] += w;
+    p->frees += w;
+    p->freed += sz * w;
+
+    if (++p->ops == SI_BATCH)
+        si_flush(p);
+
+}
+
+/**
+ * Only the calling thread's pending counts are flushed first; other threads'
+ * may be missing up to SI_BATCH operations per site. The walk stops at the
+ * first callback returning non-zero, and that value is returned.
+ */
+static void
+si_read_sizes(struct sizes *sizes, struct xmem_histogram *hist) {
+    unsigned long frees;
+    int i;
+
+    for (i = 0; i < XMEM_SIZE_CLASSES; i ++) {
+        // Frees first, so a block freed in between isn't counted as freed only
+        frees = __atomic_load_n(&sizes->frees[i], __ATOMIC_RELAXED);
+        hist->allocs[i] = __atomic_load_n(&sizes->allocs[i], __ATOMIC_RELAXED);
+        // Both are batched, and frees may be flushed before their allocations
+        hist->live[i] = hist->allocs[i] > frees ? hist->allocs[i] - frees : 0;
+    }
+
+}
+
+int
+si_walk(int (*callback)(const struct xmem_site_stats *stats, void *arg),
+        void *arg)
+{
+    struct xmem_site_stats stats;
+    struct xmem_histogram hist;
+    struct site *s;
+    int i, ret;
+
+    if (si_pending)
+        si_flush_all(si_pending);
+
+    for (i = 0; i < SI_BUCKETS; i ++) {
+        s = __atomic_load_n(&si_buckets[i], __ATOMIC_ACQUIRE);
+        for (; s; s = s->next) {
+            stats.file = s->file;
+            stats.line = s->line;
+            // Frees first, so a block freed in between isn't counted as freed
+            // only
+            stats.frees = __atomic_load_n(&s->frees, __ATOMIC_RELAXED);
+            stats.allocs = __atomic_load_n(&s->allocs, __ATOMIC_RELAXED);
+            stats.live_blocks = stats.allocs - stats.frees;
+            stats.live_bytes = __atomic_load_n(&s->live_bytes,
+                    __ATOMIC_RELAXED);
+            stats.peak_bytes = __atomic_load_n(&s->peak_bytes,
+                    __ATOMIC_RELAXED);
+            stats.total_bytes = __atomic_load_n(&s->total_bytes,
+                    __ATOMIC_RELAXED);
+            stats.histogram = NULL;
+            if (s->sizes) {
+                si_read_sizes(s->sizes, &hist);
+                stats.histogram = &hist;
+            }
+
+            ret = callback(&stats, arg);
+            if (ret)
+                return ret;
+        }
+    }
+
+    return 0;
+
+}
+
+void
+si_histogram(struct xmem_histogram *hist) {
+    if (si_pending)
+        si_flush_all(si_pending);
+
+    si_read_sizes(&si_totals, hist);
+
+}
+
+static void
+si_dump_sizes(FILE *out, struct sizes *sizes) {
+    struct xmem_histogram hist;
+    unsigned long low, high;
+    int i;
+
+    si_read_sizes(sizes, &hist);
+
+    for (i = 0; i < XMEM_SIZE_CLASSES; i ++) {
+        if (!hist.allocs[i])
+            continue;
+
+        low = i ? (1UL << (i - 1)) + 1 : 0;
+        high = 1UL << i;
+        if (i == XMEM_SIZE_CLASSES - 1)
+            fprintf(out, "  %9lu and up        ", low);
+        else
+            fprintf(out, "  %9lu - %9lu bytes", low, high);
+        fprintf(out, ": %lu live, %lu allocated\n", hist.live[i],
+                hist.allocs[i]);
+    }
+
+}
+
+static int
+si_compare(const void *a, const void *b) {
+    const struct site *sa = *(struct site * const *)a;
+    const struct site *sb = *(struct site * const *)b;
+    int ret;
+
+    ret = strcmp(sa->file, sb->file);
+
+    return ret ? ret : sa->line - sb->line;
+
+}
+
+/**
+ * Prints the process-wide histogram and those of every site, sites ordered
+ * by file and line. Like si_walk(), only the calling thread is flushed.
+ */
+void
+si_dump(FILE *out) {
+    struct site **sites = NULL, *s;
+    size_t nsites = 0, allocated = 0, j;
+    int i;
+
+    if (si_pending)
+        si_flush_all(si_pending);
+
+    fprintf(out, "Allocation sizes:\n");
+    si_dump_sizes(out, &si_totals);
+
+    if (!si_sizes)
+        return;
+
+    for (i = 0; i < SI_BUCKETS; i ++) {
+        s = __atomic_load_n(&si_buckets[i], __ATOMIC_ACQUIRE);
+        for (; s; s = s->next) {
+            if (nsites == allocated) {
+                allocated = allocated ? allocated * 2 : 64;
+                sites = realloc(sites, allocated * sizeof(struct site *));
+                if (!sites)
+                    abort();
+            }
+            sites[nsites++] = s;
+        }
+    }
+    qsort(sites, nsites, sizeof(struct site *), si_compare);
+
+    for (j = 0; j < nsites; j ++) {
+        fprintf(out, "Allocation sizes in %s, line %d:\n", sites[j]->file,
+                sites[j]->line);
+        si_dump_sizes(out, sites[j]->sizes);
+    }
+    free(sites);
+
+}
+
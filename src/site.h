@@ -0,0 +1,94 @@
+/**
+ * Copyright (c) 2014-2021, Ignacio Nin <nachex@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if !defined(SITE_H)
+#define SITE_H
+
+#include <stdlib.h>
+
+#include <account.h>
+
+/**
+ * Allocation sites: one per (file, line) pair, each keeping statistics of
+ * the blocks allocated there. Sites live until the process exits, so
+ * records can point to theirs.
+ */
+
+/**
+ * Allocations and frees by size class, see XMEM_SIZE_CLASSES.
+ */
+struct sizes {
+    unsigned long allocs[XMEM_SIZE_CLASSES];
+    unsigned long frees[XMEM_SIZE_CLASSES];
+
+};
+
+struct site {
+    const char *file;
+    int line;
+
+    struct site *next;
+
+    // Updated when threads flush their pending counts
+    unsigned long allocs;
+    unsigned long frees;
+    size_t live_bytes;
+    size_t peak_bytes;
+    size_t total_bytes;
+    struct sizes *sizes;
+
+};
+
+static inline int
+si_class(size_t sz) {
+    int cls;
+
+    if (sz <= 1)
+        return 0;
+
+    cls = 8 * sizeof(unsigned long long) - __builtin_clzll(sz - 1);
+
+    return cls < XMEM_SIZE_CLASSES ? cls : XMEM_SIZE_CLASSES - 1;
+
+}
+
+void si_set_reentrant(void);
+int si_enable_sizes(void);
+
+struct site *si_get(const char *file, int line);
+
+void si_alloc(struct site *s, size_t sz, unsigned long w);
+void si_free(struct site *s, size_t sz, unsigned long w);
+
+int si_walk(int (*callback)(const struct xmem_site_stats *stats, void *arg),
+        void *arg);
+
+void si_histogram(struct xmem_histogram *hist);
+void si_dump(FILE *out);
+
+#endif
+
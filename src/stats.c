@@ -0,0 +1,155 @@
+/**
+ * Copyright (c) 2014-2021, Ignacio Nin <nachex@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <config.h>
+
+#include "stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * The counters are plain atomics, updated without any lock. They share a
+ * cache line of their own so they don't drag anything else along when
+ * threads take turns updating them.
+ *
+ * A snapshot reads everything twice and retries until the operation counts
+ * of both reads agree, so operations completing while it reads aren't seen
+ * halfway. Those still in progress may be.
+ */
+
+#define ST_RETRIES 16
+
+static struct {
+    unsigned long allocs;
+    unsigned long frees;
+    size_t live_bytes;
+    size_t peak_bytes;
+
+} st_counters __attribute__ (( aligned(64) ));
+
+static void
+st_raise_peak(size_t live) {
+    size_t peak;
+
+    peak = __atomic_load_n(&st_counters.peak_bytes, __ATOMIC_RELAXED);
+    while (live > peak && !__atomic_compare_exchange_n(
+                &st_counters.peak_bytes, &peak, live, 1, __ATOMIC_RELAXED,
+                __ATOMIC_RELAXED))
+        ;
+
+}
+
+/**
+ * A block of weight w counts as w blocks of its size.
+ */
+void
+st_alloc(size_t sz, unsigned long w) {
+    size_t live;
+
+    live = __atomic_add_fetch(&st_counters.live_bytes, sz * w,
+            __ATOMIC_RELEASE);
+    __atomic_add_fetch(&st_counters.allocs, w, __ATOMIC_RELEASE);
+    st_raise_peak(live);
+
+}
+
+void
+st_free(size_t sz, unsigned long w) {
+    __atomic_sub_fetch(&st_counters.live_bytes, sz * w, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&st_counters.frees, w, __ATOMIC_RELEASE);
+
+}
+
+/**
+ * A reallocation counts as freeing the old block and allocating the new.
+ */
+void
+st_replace(size_t oldsz, unsigned long oldw, size_t sz, unsigned long w) {
+    size_t live;
+
+    live = __atomic_add_fetch(&st_counters.live_bytes, sz * w - oldsz * oldw,
+            __ATOMIC_RELEASE);
+    __atomic_add_fetch(&st_counters.frees, oldw, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&st_counters.allocs, w, __ATOMIC_RELEASE);
+    st_raise_peak(live);
+
+}
+
+unsigned long
+st_live_blocks(void) {
+    unsigned long frees;
+
+    // Frees first, so a block freed in between isn't counted as freed only
+    frees = __atomic_load_n(&st_counters.frees, __ATOMIC_ACQUIRE);
+
+    return __atomic_load_n(&st_counters.allocs, __ATOMIC_ACQUIRE) - frees;
+
+}
+
+static void
+st_read(struct xmem_stats *stats) {
+    stats->frees = __atomic_load_n(&st_counters.frees, __ATOMIC_ACQUIRE);
+    stats->allocs = __atomic_load_n(&st_counters.allocs, __ATOMIC_ACQUIRE);
+    stats->live_bytes = __atomic_load_n(&st_counters.live_bytes,
+            __ATOMIC_ACQUIRE);
+    stats->peak_bytes = __atomic_load_n(&st_counters.peak_bytes,
+            __ATOMIC_ACQUIRE);
+
+}
+
+/**
+ * If the counters keep changing for too long, the last read is returned as
+ * is.
+ */
+void
+st_snapshot(struct xmem_stats *stats) {
+    struct xmem_stats again;
+    int i;
+
+    st_read(stats);
+    for (i = 0; i < ST_RETRIES; i ++) {
+        st_read(&again);
+        if (again.allocs == stats->allocs && again.frees == stats->frees)
+            break;
+        *stats = again;
+    }
+
+    stats->live_blocks = stats->allocs - stats->frees;
+    if (stats->peak_bytes < stats->live_bytes)
+        stats->peak_bytes = stats->live_bytes;
+
+}
+
+void
+st_reset_peak(void) {
+    __atomic_store_n(&st_counters.peak_bytes,
+            __atomic_load_n(&st_counters.live_bytes, __ATOMIC_ACQUIRE),
+            __ATOMIC_RELEASE);
+
+}
+
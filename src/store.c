@@ -25,6 +25,8 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <config.h>
+
 #include "store.h"
 
 #include <stdlib.h>
@@ -32,42 +34,132 @@
 #include <string.h>
 #include <stdio.h>
 
+#include <unistd.h>
 #include <pthread.h>
 
-#include "uthash.h"
+#include "addr.h"
+#include "depot.h"
+#include "format.h"
+#include "intern.h"
+#include "profile.h"
+#include "site.h"
+#include "slab.h"
+#include "stats.h"
+#include "table.h"
 
 /**
- * We'll store the used pointers in a simple list. Perhaps in the future it's
- * worthy to implement a hash, but for the time it's not -- and search.h is
- * frankly unusable.
+ * Records are kept in a hash keyed by pointer, split into independent shards
+ * each with its own lock so that threads working on different blocks don't
+ * serialize on a single mutex. The shard is picked from the pointer bits.
+ * There's a single shard unless configured otherwise.
+ *
+ * Each shard also keeps its records in a list in the order they were added
+ * (or last replaced), which is the order they're walked in.
+ *
+ * Shard locks are reader/writer locks: plain lookups, which is all the
+ * check path does, share the lock and only wait behind actual changes to the
+ * shard. Writers are preferred where the platform allows it, so a busy check
+ * loop can't starve frees.
  */
 
 struct storage {
     void *ptr;
     size_t sz;
+    unsigned long weight;
+    uint32_t stack;
+    uint32_t epoch;
 
     char *txt;
-    char *file;
-    int line;
+    struct site *site;
 
-    UT_hash_handle hh;
+    // Lazy mode: txt is rendered from this when first needed
+    struct lazy *lazy;
 
-} *storage;
+    struct storage *prev;
+    struct storage *next;
 
-int as_reentrant;
-int walking;
-pthread_mutex_t storage_mx = PTHREAD_MUTEX_INITIALIZER;
+};
+
+/**
+ * The format and captured arguments of a deferred text, kept apart so
+ * records only pay for a pointer when not in lazy mode. They come from a
+ * slab of the shard, like records; only captures larger than AS_LAZYARGS
+ * are allocated on their own. Given back once the text is rendered.
+ */
+#define AS_LAZYARGS 40
+
+struct lazy {
+    const char *fmt;
+    void *args;
+    char argbuf[AS_LAZYARGS];
+
+};
+
+#define AS_MAXSHARDS 256
+
+struct shard {
+    struct table index;
+    struct storage *head;
+    struct storage *tail;
+
+    struct slab records;
+    struct slab lazies;
+    pthread_rwlock_t lk;
 
-#define LOCK() \
+} __attribute__ (( aligned(64) ));
+
+#if defined(PTHREAD_RWLOCK_WRITER_NONRECURSIVE_INITIALIZER_NP)
+#define AS_RWLOCK_INITIALIZER PTHREAD_RWLOCK_WRITER_NONRECURSIVE_INITIALIZER_NP
+#else
+#define AS_RWLOCK_INITIALIZER PTHREAD_RWLOCK_INITIALIZER
+#endif
+
+struct shard shards[AS_MAXSHARDS] = {
+    [0 ... AS_MAXSHARDS - 1] = {
+        TABLE_INITIALIZER, NULL, NULL,
+        SLAB_INITIALIZER(struct storage), SLAB_INITIALIZER(struct lazy),
+        AS_RWLOCK_INITIALIZER
+    }
+};
+unsigned as_shardmask;
+
+unsigned long as_generation;
+uint32_t as_epoch;
+
+int as_reentrant;
+int as_lazy;
+int as_addrindex;
+int as_weighted;
+int as_used;
+// The shard locked by the walk the thread is in, if any, so that callbacks
+// can look up blocks in it
+static __thread struct shard *walking;
+
+#define LOCK(sh) \
     do { \
         if (as_reentrant) \
-            pthread_mutex_lock(&storage_mx); \
+            PF_LOCK(pthread_rwlock_trywrlock(&(sh)->lk), \
+                    pthread_rwlock_wrlock(&(sh)->lk)); \
     } while(0)
-#define UNLOCK() \
+#define RDLOCK(sh) \
     do { \
         if (as_reentrant) \
-            pthread_mutex_unlock(&storage_mx); \
+            PF_LOCK(pthread_rwlock_tryrdlock(&(sh)->lk), \
+                    pthread_rwlock_rdlock(&(sh)->lk)); \
     } while(0)
+#define UNLOCK(sh) \
+    do { \
+        if (as_reentrant) \
+            pthread_rwlock_unlock(&(sh)->lk); \
+    } while(0)
+
+static struct shard *
+as_shard(const void *ptr) {
+    unsigned long long h = (unsigned long long)(size_t)ptr >> 4;
+
+    return &shards[(h * 0x9e3779b97f4a7c15ULL) >> 56 & as_shardmask];
+
+}
 
 void
 as_create(void) {
@@ -78,16 +170,170 @@ as_create(void) {
 void
 as_set_reentrant(void) {
     as_reentrant = 1;
+    in_set_reentrant();
+    si_set_reentrant();
+    dp_set_reentrant();
+    ad_set_reentrant();
+
+}
+
+void
+as_set_lazy(void) {
+    as_lazy = 1;
+
+}
+
+int
+as_set_shards(int n) {
+    unsigned count;
+
+    // Records already stored would end up in the wrong shard
+    if (!as_pristine() || n < 1)
+        return 0;
+
+    for (count = 1; count < n && count < AS_MAXSHARDS; count <<= 1)
+        ;
+    as_shardmask = count - 1;
+
+    return count;
+
+}
+
+int
+as_enable_addr_index(void) {
+    // Blocks already stored would be missing from it
+    if (!as_addrindex && !as_pristine())
+        return 0;
+
+    as_addrindex = 1;
+
+    return 1;
+
+}
+
+void
+as_reserve(size_t n) {
+    struct shard *sh;
+    size_t each;
+
+    // Leave some room for shards getting more than their share
+    each = n / (as_shardmask + 1);
+    each += each / 8;
+
+    for (sh = shards; sh <= &shards[as_shardmask]; sh ++) {
+        LOCK(sh);
+        tb_reserve(&sh->index, each);
+        UNLOCK(sh);
+    }
+
+}
+
+/**
+ * Starts a new epoch and returns it. Records added from now on, and only
+ * those, have an epoch at least as high.
+ */
+uint32_t
+as_mark(void) {
+    return __atomic_add_fetch(&as_epoch, 1, __ATOMIC_RELAXED);
+
+}
+
+int
+as_pristine(void) {
+    return !as_used;
+
+}
+
+/**
+ * Once records may stand for more than one block, the global counters no
+ * longer tell how many records there are.
+ */
+void
+as_set_weighted(void) {
+    as_weighted = 1;
+
+}
+
+/**
+ * Adds a record to a shard, at the end of its list. Must be called with the
+ * shard locked.
+ */
+static void
+as_link(struct shard *sh, struct storage *st) {
+    st->prev = sh->tail;
+    st->next = NULL;
+    if (sh->tail)
+        sh->tail->next = st;
+    else
+        sh->head = st;
+    sh->tail = st;
+
+    tb_insert(&sh->index, st->ptr, st);
+
+}
+
+/**
+ * Removes and returns the record for ptr, or NULL if there's none. Must be
+ * called with the shard locked.
+ */
+static struct storage *
+as_unlink(struct shard *sh, const void *ptr) {
+    struct storage *st;
+
+    st = tb_remove(&sh->index, ptr);
+    if (!st)
+        return NULL;
+
+    if (st->prev)
+        st->prev->next = st->next;
+    else
+        sh->head = st->next;
+    if (st->next)
+        st->next->prev = st->prev;
+    else
+        sh->tail = st->prev;
+
+    return st;
+
+}
+
+/**
+ * Gives back the deferred text of a record. Must be called with the lock of
+ * the shard held; the record may have been allocated in another one.
+ */
+static void
+as_drop_lazy(struct shard *sh, struct lazy *lazy) {
+    if (lazy->args != lazy->argbuf)
+        free(lazy->args);
+    sl_free(&sh->lazies, lazy);
+
+}
+
+/**
+ * Returns the text of a record, formatting it first if it was deferred. Must
+ * be called with the lock of its shard held.
+ */
+static char *
+as_text(struct shard *sh, struct storage *st) {
+    if (!st->txt) {
+        st->txt = fm_render(st->lazy->fmt, st->lazy->args);
+        as_drop_lazy(sh, st->lazy);
+        st->lazy = NULL;
+    }
+
+    return st->txt;
 
 }
 
 int
-as_add(void *ptr, size_t sz, char *file, int line, const char txt[], ...) {
+as_add(void *ptr, size_t sz, unsigned long weight, uint32_t stack,
+        char *file, int line, const char txt[], ...)
+{
     va_list va;
     int ret;
 
     va_start(va, txt);
-    ret = as_vadd(ptr, sz, file, line, txt, va);
+    ret = as_vadd(ptr, sz, weight, stack, file, line, txt, va);
     va_end(va);
 
     return ret;
@@ -95,63 +341,134 @@ as_add(void *ptr, size_t sz, char *file, int line, const char txt[], ...) {
 }
     
 int
-as_vadd(void *ptr, size_t sz, char *file, int line,
-        const char txt[], va_list args)
+as_vadd(void *ptr, size_t sz, unsigned long weight, uint32_t stack,
+        char *file, int line, const char txt[], va_list args)
 {
+    char capture[FM_MAXCAPTURE];
     va_list argscopy;
-    struct storage *st;
+    struct storage rec, *st;
+    struct shard *sh;
+    const char *fmt = NULL;
+    void *bigargs = NULL;
     size_t flen;
+    int alen = 0;
 
-    st = malloc(sizeof(struct storage));
-    if (!st)
-        abort();
-    memset(st, 0, sizeof(struct storage));
-
-    st->ptr = ptr;
-    st->sz = sz;
-
-    st->file = strdup(file);
-    st->line = line;
-
-    // Calculate the sz of format string
-    va_copy(argscopy, args);
-    flen = vsnprintf(NULL, 0, txt, args);
-    st->txt = malloc(flen + 1);
-    if (!st->txt)
-        abort();
-    vsnprintf(st->txt, flen + 1, txt, argscopy);
-    st->txt[flen] = '\0';
+    as_used = 1;
+
+    // Filled in before taking the lock, and copied into place afterwards
+    memset(&rec, 0, sizeof(struct storage));
+
+    rec.ptr = ptr;
+    rec.sz = sz;
+    rec.weight = weight;
+    rec.stack = stack;
+    rec.epoch = __atomic_load_n(&as_epoch, __ATOMIC_RELAXED);
+
+    rec.site = si_get(in_intern(file), line);
+
+    if (as_lazy) {
+        va_copy(argscopy, args);
+        alen = fm_capture(capture, sizeof(capture), txt, argscopy);
+        va_end(argscopy);
+
+        if (alen > AS_LAZYARGS) {
+            if (!(bigargs = malloc(alen)))
+                abort();
+            memcpy(bigargs, capture, alen);
+        }
+        if (alen >= 0)
+            fmt = txt;
+    }
+
+    if (!fmt) {
+        // Calculate the sz of format string
+        va_copy(argscopy, args);
+        flen = vsnprintf(NULL, 0, txt, args);
+        rec.txt = malloc(flen + 1);
+        if (!rec.txt)
+            abort();
+        vsnprintf(rec.txt, flen + 1, txt, argscopy);
+        va_end(argscopy);
+        rec.txt[flen] = '\0';
+    }
     
-    LOCK();
-    HASH_ADD_PTR(storage, ptr, st);
-    UNLOCK();
+    sh = as_shard(ptr);
+    LOCK(sh);
+    st = sl_alloc(&sh->records);
+    *st = rec;
+    if (fmt) {
+        st->lazy = sl_alloc(&sh->lazies);
+        st->lazy->fmt = fmt;
+        st->lazy->args = bigargs;
+        if (!bigargs) {
+            st->lazy->args = st->lazy->argbuf;
+            memcpy(st->lazy->argbuf, capture, alen);
+        }
+    }
+    as_link(sh, st);
+    UNLOCK(sh);
+
+    si_alloc(rec.site, sz, weight);
+    st_alloc(sz, weight);
+
+    if (as_addrindex)
+        ad_insert(ptr, sz);
 
     return 1;
 
 }
 
 int
-as_replace(void *prev, void *ptr, size_t sz, char *file, int line) {
+as_replace(void *prev, void *ptr, size_t sz, unsigned long weight,
+        uint32_t stack, char *file, int line)
+{
     struct storage *curr;
+    struct shard *from, *to;
+    struct site *site, *oldsite;
+    unsigned long oldweight;
+    size_t oldsz;
+
+    site = si_get(in_intern(file), line);
 
-    LOCK();
-    HASH_FIND_PTR(storage, &prev, curr);
+    from = as_shard(prev);
+    to = as_shard(ptr);
+
+    LOCK(from);
+    curr = as_unlink(from, prev);
     if (!curr) {
-        UNLOCK();
+        UNLOCK(from);
         return 0;
     }
 
-    HASH_DEL(storage, curr);
+    __atomic_add_fetch(&as_generation, 1, __ATOMIC_RELEASE);
+    if (from != to) {
+        UNLOCK(from);
+        LOCK(to);
+    }
+
+    oldsite = curr->site;
+    oldsz = curr->sz;
+    oldweight = curr->weight;
 
     curr->ptr = ptr;
     curr->sz = sz;
-
-    free(curr->file);
-    curr->file = strdup(file);
-    curr->line = line;
-
-    HASH_ADD_PTR(storage, ptr, curr);
-    UNLOCK();
+    curr->weight = weight;
+    curr->stack = stack;
+    curr->site = site;
+
+    // The record stays in the slab of its original shard, which is fine
+    as_link(to, curr);
+    UNLOCK(to);
+
+    // Counted as freed where it was last allocated and allocated here
+    si_free(oldsite, oldsz, oldweight);
+    si_alloc(site, sz, weight);
+    st_replace(oldsz, oldweight, sz, weight);
+
+    if (as_addrindex) {
+        ad_remove(prev);
+        ad_insert(ptr, sz);
+    }
 
     return 1;
 
@@ -160,41 +477,58 @@ as_replace(void *prev, void *ptr, size_t sz, char *file, int line) {
 int
 as_get(const void *ptr, size_t *sz) {
     struct storage *curr;
+    struct shard *sh;
 
-    LOCK();
-    HASH_FIND_PTR(storage, &ptr, curr);
+    sh = as_shard(ptr);
+    RDLOCK(sh);
+    curr = tb_find(&sh->index, ptr);
 
     if (!curr) {
-        UNLOCK();
+        UNLOCK(sh);
         return 0;
     }
 
     *sz = curr->sz;
-    UNLOCK();
+    UNLOCK(sh);
 
     return 1;
 
 }
 
+/**
+ * Finds the block containing ptr. Returns -1 if the address index is not
+ * enabled.
+ */
+int
+as_find(const void *ptr, const void **base, size_t *sz) {
+    if (!as_addrindex)
+        return -1;
+
+    return ad_find(ptr, base, sz);
+
+}
+
 char *
 as_character(const void *ptr) {
     struct storage *curr;
+    struct shard *sh;
     char *ret;
 
-    if (!walking)
-        LOCK();
-    HASH_FIND_PTR(storage, &ptr, curr);
+    sh = as_shard(ptr);
+    if (sh != walking)
+        LOCK(sh);
+    curr = tb_find(&sh->index, ptr);
 
     if (!curr) {
-        if (!walking)
-            UNLOCK();
+        if (sh != walking)
+            UNLOCK(sh);
         return NULL;
     }
 
     // TODO: This is not entirely safe.
-    ret = curr->txt;
-    if (!walking)
-        UNLOCK();
+    ret = as_text(sh, curr);
+    if (sh != walking)
+        UNLOCK(sh);
     return ret;
 
 }
@@ -202,52 +536,143 @@ as_character(const void *ptr) {
 int
 as_delete(void *ptr) {
     struct storage *curr;
+    struct shard *sh;
+    struct site *site;
+    unsigned long weight;
+    size_t sz;
+    char *txt;
 
-    LOCK();
-    HASH_FIND_PTR(storage, &ptr, curr);
+    sh = as_shard(ptr);
+    LOCK(sh);
+    curr = as_unlink(sh, ptr);
     if (!curr) {
-        UNLOCK();
+        UNLOCK(sh);
         return 0;
     }
+    __atomic_add_fetch(&as_generation, 1, __ATOMIC_RELEASE);
+
+    site = curr->site;
+    sz = curr->sz;
+    weight = curr->weight;
+    txt = curr->txt;
+    if (curr->lazy)
+        as_drop_lazy(sh, curr->lazy);
+    sl_free(&sh->records, curr);
+    UNLOCK(sh);
+
+    si_free(site, sz, weight);
+    st_free(sz, weight);
 
-    HASH_DEL(storage, curr);
-    UNLOCK();
+    free(txt);
 
-    free(curr->file);
-    free(curr->txt);
-    free(curr);
+    if (as_addrindex)
+        ad_remove(ptr);
 
     return 1;
 
 }
 
+static int
+as_walk_texts(int (*callback)(const struct as_block *block, void *arg),
+        void *arg, int render)
+{
+    struct storage *curr;
+    struct shard *sh;
+    struct as_block block;
+
+    for (sh = shards; sh <= &shards[as_shardmask]; sh ++) {
+        LOCK(sh);
+        walking = sh;
+        for (curr = sh->head; curr; curr = curr->next) {
+            block.ptr = curr->ptr;
+            block.sz = curr->sz;
+            block.weight = curr->weight;
+            block.stack = curr->stack;
+            block.epoch = curr->epoch;
+            if (render || curr->txt)
+                block.txt = as_text(sh, curr);
+            else
+                block.txt = (char *)curr->lazy->fmt;
+            block.file = curr->site->file;
+            block.line = curr->site->line;
+            callback(&block, arg);
+        }
+        walking = NULL;
+        UNLOCK(sh);
+    }
+
+    return 0;
+
+}
+
 int
 as_walk(callback, arg)
-    int (*callback)(void *ptr, size_t sz,
-            char txt[], char *file, int line, void *arg);
+    int (*callback)(const struct as_block *block, void *arg);
     void *arg;
 {
-    struct storage *curr;
+    return as_walk_texts(callback, arg, 1);
 
-    LOCK();
-    walking = 1;
-    for (curr = storage; curr; curr = curr->hh.next)
-        callback(curr->ptr, curr->sz, curr->txt, curr->file, curr->line, arg);
-    walking = 0;
-    UNLOCK();
+}
 
-    return 0;
+/**
+ * For the child left by as_fork(), where rendering a deferred text could
+ * wait forever on a lock held by a thread that didn't make it across: such
+ * texts are handed out as their format instead.
+ */
+int
+as_walk_unrendered(int (*callback)(const struct as_block *block, void *arg),
+        void *arg)
+{
+    return as_walk_texts(callback, arg, 0);
 
 }
 
+/**
+ * Taken from the global counters if they count records, so no shard has to
+ * be locked.
+ */
 int
 as_count(void) {
-    int r;
+    struct shard *sh;
+    int r = 0;
+
+    if (!as_weighted)
+        return st_live_blocks();
 
-    LOCK();
-    r = HASH_COUNT(storage);
-    UNLOCK();
+    for (sh = shards; sh <= &shards[as_shardmask]; sh ++) {
+        RDLOCK(sh);
+        r += tb_count(&sh->index);
+        UNLOCK(sh);
+    }
 
     return r;
 
 }
+
+/**
+ * Forks with every shard locked, so the child gets the store as it stood
+ * between two operations, and threads only wait for as long as fork()
+ * takes. The child is left with the locks taken and no other thread, and
+ * goes on without locking; it can't release them, since the lock owner is
+ * told by thread id.
+ */
+pid_t
+as_fork(void) {
+    struct shard *sh;
+    pid_t pid;
+
+    for (sh = shards; sh <= &shards[as_shardmask]; sh ++)
+        LOCK(sh);
+
+    pid = fork();
+    if (!pid) {
+        as_reentrant = 0;
+        return 0;
+    }
+
+    for (sh = shards; sh <= &shards[as_shardmask]; sh ++)
+        UNLOCK(sh);
+
+    return pid;
+
+}
@@ -30,22 +30,67 @@
 
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stdint.h>
+
+#include <sys/types.h>
+
+/**
+ * Bumped every time a block goes away or moves, so that lookups cached
+ * elsewhere can tell they may be stale.
+ */
+extern unsigned long as_generation;
 
 void as_create(void);
 void as_set_reentrant(void);
+void as_set_lazy(void);
+int as_set_shards(int n);
+void as_reserve(size_t n);
+int as_enable_addr_index(void);
+int as_pristine(void);
+void as_set_weighted(void);
+uint32_t as_mark(void);
 
-int as_add(void *ptr, size_t sz, char *file, int line, const char txt[], ...)
-        __attribute__ (( format(printf, 5, 6) ));
-int as_vadd(void *ptr, size_t sz, char *file, int line, const char txt[],
-        va_list args);
-int as_replace(void *prev, void *ptr, size_t sz, char *file, int line);
+/**
+ * Records have a weight, the number of blocks they stand for in statistics,
+ * which is 1 unless sampling, and the id of their allocation stack in the
+ * stack depot, if any. They're also stamped with the epoch they were added
+ * in, which as_mark() moves on; replacing a record keeps its epoch.
+ */
+int as_add(void *ptr, size_t sz, unsigned long weight, uint32_t stack,
+        char *file, int line, const char txt[], ...)
+    __attribute__ (( format(printf, 7, 8) ));
+int as_vadd(void *ptr, size_t sz, unsigned long weight, uint32_t stack,
+        char *file, int line, const char txt[], va_list args);
+int as_replace(void *prev, void *ptr, size_t sz, unsigned long weight,
+        uint32_t stack, char *file, int line);
 int as_delete(void *ptr);
 
 int as_count(void);
 int as_get(const void *ptr, size_t *sz);
+int as_find(const void *ptr, const void **base, size_t *sz);
 char *as_character(const void *ptr);
-int as_walk(int (*callback)(void *ptr, size_t sz, char txt[],
-        char *file, int line, void *arg), void *arg);
+/**
+ * A block as seen when walking the store.
+ */
+struct as_block {
+    void *ptr;
+    size_t sz;
+    unsigned long weight;
+    uint32_t stack;
+    uint32_t epoch;
+
+    char *txt;
+    const char *file;
+    int line;
+
+};
+
+int as_walk(int (*callback)(const struct as_block *block, void *arg),
+        void *arg);
+int as_walk_unrendered(int (*callback)(const struct as_block *block,
+            void *arg), void *arg);
+
+pid_t as_fork(void);
 
 #endif
 
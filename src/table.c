@@ -0,0 +1,254 @@
+/**
+ * Copyright (c) 2014-2021, Ignacio Nin <nachex@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "table.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Linear probing over a power-of-two array of (key, value) slots, four to a
+ * cache line. Keys come from malloc(), so their low bits carry no
+ * information; they're dropped and the rest is spread with a multiplicative
+ * hash, taking the top bits of the product.
+ *
+ * Removal shifts the following entries of the cluster back instead of
+ * leaving tombstones, so lookups never have to skip over deleted slots.
+ *
+ * Growing doesn't rehash everything at once: a new array twice the size
+ * takes the inserts, while every insert and remove moves a bounded number
+ * of slots over from the old one. Entries are moved out of the old array
+ * with the same backward shift, so it stays valid for lookups until it's
+ * empty. Since at least two old slots are moved per insert, the old array
+ * is always empty by the time the new one needs to grow again.
+ */
+
+#define TB_MINSIZE 64
+#define TB_MIGRATE 16
+
+static size_t
+tb_hash(const struct tb_array *arr, const void *key) {
+    return (((uintptr_t)key >> 4) * 0xff51afd7ed558ccdULL) >> arr->shift;
+
+}
+
+static void
+tb_alloc(struct tb_array *arr, size_t size) {
+    int bits;
+
+    for (bits = 0; (size_t)1 << bits < size; bits ++)
+        ;
+
+    arr->slots = calloc(size, sizeof(struct tb_slot));
+    if (!arr->slots)
+        abort();
+    arr->mask = size - 1;
+    arr->shift = 64 - bits;
+    arr->count = 0;
+
+}
+
+static size_t
+tb_lookup(const struct tb_array *arr, const void *key) {
+    size_t i;
+
+    for (i = tb_hash(arr, key); arr->slots[i].key; i = (i + 1) & arr->mask)
+        if (arr->slots[i].key == key)
+            return i;
+
+    return (size_t)-1;
+
+}
+
+static void
+tb_put(struct tb_array *arr, const void *key, void *val) {
+    size_t i;
+
+    for (i = tb_hash(arr, key); arr->slots[i].key; i = (i + 1) & arr->mask)
+        ;
+
+    arr->slots[i].key = key;
+    arr->slots[i].val = val;
+    arr->count ++;
+
+}
+
+static void
+tb_clear(struct tb_array *arr, size_t i) {
+    size_t j, home;
+
+    // Pull back every entry that is at least as far from home as the hole
+    for (j = (i + 1) & arr->mask; arr->slots[j].key; j = (j + 1) & arr->mask) {
+        home = tb_hash(arr, arr->slots[j].key);
+        if (((j - home) & arr->mask) >= ((j - i) & arr->mask)) {
+            arr->slots[i] = arr->slots[j];
+            i = j;
+        }
+    }
+
+    arr->slots[i].key = NULL;
+    arr->slots[i].val = NULL;
+    arr->count --;
+
+}
+
+/**
+ * Moves up to max old slots into the current array.
+ */
+static void
+tb_migrate(struct table *tb, size_t max) {
+    struct tb_array *old = &tb->old;
+    size_t i;
+
+    if (!old->slots)
+        return;
+
+    while (max -- && old->count) {
+        i = tb->migrated;
+        if (!old->slots[i].key) {
+            tb->migrated ++;
+            continue;
+        }
+
+        // The slot may be refilled by the shift, so it's visited again
+        tb_put(&tb->cur, old->slots[i].key, old->slots[i].val);
+        tb_clear(old, i);
+    }
+
+    if (!old->count) {
+        free(old->slots);
+        old->slots = NULL;
+        tb->migrated = 0;
+    }
+
+}
+
+static void
+tb_grow(struct table *tb, size_t size) {
+    // Only one resize in flight; normally long finished by now
+    tb_migrate(tb, (size_t)-1);
+
+    tb->old = tb->cur;
+    tb->migrated = 0;
+    tb_alloc(&tb->cur, size);
+
+}
+
+void *
+tb_find(const struct table *tb, const void *key) {
+    size_t i;
+
+    if (!tb->cur.slots)
+        return NULL;
+
+    if ((i = tb_lookup(&tb->cur, key)) != (size_t)-1)
+        return tb->cur.slots[i].val;
+
+    if (tb->old.slots && (i = tb_lookup(&tb->old, key)) != (size_t)-1)
+        return tb->old.slots[i].val;
+
+    return NULL;
+
+}
+
+void
+tb_insert(struct table *tb, const void *key, void *val) {
+    if (!tb->cur.slots)
+        tb_alloc(&tb->cur, TB_MINSIZE);
+    else if ((tb_count(tb) + 1) * 4 > (tb->cur.mask + 1) * 3)
+        tb_grow(tb, (tb->cur.mask + 1) * 2);
+
+    tb_migrate(tb, TB_MIGRATE);
+    tb_put(&tb->cur, key, val);
+
+}
+
+void *
+tb_remove(struct table *tb, const void *key) {
+    struct tb_array *arr;
+    size_t i;
+    void *ret;
+
+    if (!tb->cur.slots)
+        return NULL;
+
+    tb_migrate(tb, TB_MIGRATE);
+
+    arr = &tb->cur;
+    i = tb_lookup(arr, key);
+    if (i == (size_t)-1 && tb->old.slots) {
+        arr = &tb->old;
+        i = tb_lookup(arr, key);
+    }
+    if (i == (size_t)-1)
+        return NULL;
+
+    ret = arr->slots[i].val;
+    tb_clear(arr, i);
+
+    // Releases the old array if that was its last entry
+    if (arr == &tb->old)
+        tb_migrate(tb, 0);
+
+    return ret;
+
+}
+
+/**
+ * Sizes the table to hold n entries without growing again, and finishes any
+ * pending migration.
+ */
+void
+tb_reserve(struct table *tb, size_t n) {
+    size_t size;
+
+    for (size = TB_MINSIZE; size / 4 * 3 < n; size *= 2)
+        ;
+
+    if (!tb->cur.slots)
+        tb_alloc(&tb->cur, size);
+    else if (size > tb->cur.mask + 1)
+        tb_grow(tb, size);
+
+    tb_migrate(tb, (size_t)-1);
+
+}
+
+size_t
+tb_count(const struct table *tb) {
+    return tb->cur.count + tb->old.count;
+
+}
+
+void
+tb_destroy(struct table *tb) {
+    free(tb->cur.slots);
+    free(tb->old.slots);
+    memset(tb, 0, sizeof(struct table));
+
+}
@@ -0,0 +1,73 @@
+/**
+ * Copyright (c) 2014-2021, Ignacio Nin <nachex@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if !defined(TABLE_H)
+#define TABLE_H
+
+#include <stdlib.h>
+
+/**
+ * Open addressing hash table keyed by pointer. NULL is not a valid key.
+ */
+
+struct tb_slot {
+    const void *key;
+    void *val;
+
+};
+
+struct tb_array {
+    struct tb_slot *slots;
+    size_t mask;
+    int shift;
+
+    size_t count;
+
+};
+
+/**
+ * While growing, entries are moved from old to cur a few at a time, and
+ * both have to be looked at.
+ */
+struct table {
+    struct tb_array cur;
+    struct tb_array old;
+    size_t migrated;
+
+};
+
+#define TABLE_INITIALIZER { { NULL, 0, 0, 0 }, { NULL, 0, 0, 0 }, 0 }
+
+void *tb_find(const struct table *tb, const void *key);
+void tb_insert(struct table *tb, const void *key, void *val);
+void *tb_remove(struct table *tb, const void *key);
+void tb_reserve(struct table *tb, size_t n);
+size_t tb_count(const struct table *tb);
+void tb_destroy(struct table *tb);
+
+#endif
+
@@ -0,0 +1,80 @@
+/**
+ * Copyright (c) 2014-2021, Ignacio Nin <nachex@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define ENABLE_LIBXMEM 1
+#include <libxmem.h>
+#include <stdio.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define LOG "binlog_fork.bin"
+#define ROUNDS 10000
+
+/**
+ * The child has no writer thread to drain its ring, and must neither wait
+ * for one nor write to the parent's log.
+ */
+static void
+churn(void) {
+    int i;
+
+    for (i = 0; i < ROUNDS; i ++)
+        xfree(xmalloc(16, "Block %d", i));
+
+}
+
+int
+main(int argc, char *argv[]) {
+    int status;
+    pid_t pid;
+
+    xmem_set_reentrant();
+    printf("Binlog: %d\n", xmem_enable_binlog(LOG));
+    churn();
+
+    fflush(stdout);
+    pid = fork();
+    if (!pid) {
+        // Killed instead of hanging if it spins
+        alarm(10);
+        churn();
+        exit(0);
+    }
+
+    waitpid(pid, &status, 0);
+    if (WIFEXITED(status))
+        printf("Child exited with %d\n", WEXITSTATUS(status));
+    else
+        printf("Child killed by signal %d\n", WTERMSIG(status));
+
+    churn();
+    unlink(LOG);
+
+    return 0;
+
+}
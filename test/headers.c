@@ -0,0 +1,95 @@
+/**
+ * Copyright (c) 2014-2021, Ignacio Nin <nachex@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define ENABLE_LIBXMEM 1
+#include <libxmem.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+/**
+ * A base that isn't a block, right after an unmapped page where its header
+ * would be, must be reported as not found rather than read.
+ */
+static void
+check_foreign(void) {
+    char *pages;
+    long pagesz = sysconf(_SC_PAGESIZE);
+    int status;
+    pid_t pid;
+
+    pages = mmap(NULL, 2 * pagesz, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    munmap(pages, pagesz);
+
+    fflush(stdout);
+    pid = fork();
+    if (!pid) {
+        // The message has the address in it
+        dup2(open("/dev/null", O_WRONLY), 2);
+        check(pages + pagesz, pages + pagesz);
+        _exit(0);
+    }
+
+    waitpid(pid, &status, 0);
+    printf("Foreign base: %s\n", WIFSIGNALED(status) &&
+            WTERMSIG(status) == SIGABRT ? "not found" : "not caught");
+
+}
+
+int
+main(int argc, char *argv[]) {
+    char *a, *b, *c;
+
+    if (!xmem_enable_headers()) {
+        fprintf(stderr, "Could not enable headers\n");
+        return 1;
+    }
+
+    a = xmalloc(100, "%s", "first");
+    b = xstrdup("a string");
+    c = xstrndup("truncated string", 9);
+
+    check(a + 99, a);
+    checkr(b, strlen(b) + 1, b);
+    checkr(c, 10, c);
+
+    a = xrealloc(a, 1000);
+    checkr(a, 1000, a);
+    xfree(b);
+
+    check_foreign();
+    // Before the report on stderr
+    fflush(stdout);
+
+    return 0;
+
+}
@@ -0,0 +1,97 @@
+/**
+ * Copyright (c) 2014-2021, Ignacio Nin <nachex@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define ENABLE_LIBXMEM 1
+#include <libxmem.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+
+#define DUMP "heap_dump.out"
+
+static void
+print_dump(void) {
+    char line[256];
+    FILE *in;
+    int count, pid;
+
+    in = fopen(DUMP, "r");
+    if (!in) {
+        printf("No dump\n");
+        return;
+    }
+
+    // The pid changes from run to run
+    if (fgets(line, sizeof(line), in) &&
+            sscanf(line, "%d allocated %*s %*s in process %d:", &count,
+                &pid) == 2)
+        printf("%d blocks in %s\n", count,
+                pid == getpid() ? "this process" : "another process");
+    while (fgets(line, sizeof(line), in))
+        fputs(line, stdout);
+
+    fclose(in);
+    unlink(DUMP);
+
+}
+
+int
+main(int argc, char *argv[]) {
+    char *blocks[3];
+    int i;
+
+    xmem_set_reentrant();
+
+    for (i = 0; i < 3; i ++)
+        blocks[i] = xmalloc(10 * (i + 1), "Block %d", i);
+
+    printf("Dump: %d\n", xmem_dump_heap(DUMP));
+    print_dump();
+
+    // The child is reaped by the system, before libxmem can wait for it
+    signal(SIGCHLD, SIG_IGN);
+    printf("Dump with SIGCHLD ignored: %d\n", xmem_dump_heap(DUMP));
+    unlink(DUMP);
+    signal(SIGCHLD, SIG_DFL);
+
+    printf("Signal: %d\n", xmem_dump_on_signal(SIGUSR2, DUMP));
+    blocks[1] = xrealloc(blocks[1], 50);
+    xfree(blocks[0]);
+    raise(SIGUSR2);
+
+    // The dump is renamed into place once complete
+    for (i = 0; i < 1000 && access(DUMP, F_OK); i ++)
+        usleep(10000);
+    print_dump();
+
+    for (i = 1; i < 3; i ++)
+        xfree(blocks[i]);
+
+    return 0;
+
+}
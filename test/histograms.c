@@ -0,0 +1,66 @@
+/**
+ * Copyright (c) 2014-2021, Ignacio Nin <nachex@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define ENABLE_LIBXMEM 1
+#include <libxmem.h>
+#include <stdio.h>
+
+int
+main(int argc, char *argv[]) {
+    struct xmem_histogram hist;
+    char *small[100], *big;
+    int i;
+
+    if (!xmem_enable_site_histograms()) {
+        fprintf(stderr, "Could not enable site histograms\n");
+        return 1;
+    }
+    xmem_report_histograms_at_exit();
+
+    for (i = 0; i < 100; i ++)
+        small[i] = xmalloc(i + 1, "Small block %d", i);
+    for (i = 0; i < 50; i ++)
+        xfree(small[i]);
+
+    big = xmalloc(5000, "Big block");
+    big = xrealloc(big, 70000);
+
+    xmem_size_histogram(&hist);
+    printf("Up to 64 bytes: %lu live out of %lu\n", hist.live[6],
+            hist.allocs[6]);
+
+    xmem_dump_histograms(stdout);
+    fflush(stdout);
+
+    for (i = 50; i < 100; i ++)
+        xfree(small[i]);
+    xfree(big);
+
+    return 0;
+
+}
+
@@ -0,0 +1,82 @@
+/**
+ * Copyright (c) 2014-2021, Ignacio Nin <nachex@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define ENABLE_LIBXMEM 1
+#include <libxmem.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#define ALLOCATIONS 4096
+
+int
+main(int argc, char *argv[]) {
+    char *alloc[ALLOCATIONS];
+    size_t sz[ALLOCATIONS];
+    int i, r, off;
+
+    if (!xmem_enable_address_index()) {
+        fprintf(stderr, "Could not enable the address index\n");
+        return 1;
+    }
+
+    srand(0);
+
+    for (i = 0; i < ALLOCATIONS; i ++) {
+        sz[i] = rand() % 512 + 1;
+        alloc[i] = xmalloc(sz[i], "Block %d", i);
+    }
+
+    for (i = 0; i < ALLOCATIONS * 16; i ++) {
+        r = rand() % ALLOCATIONS;
+
+        switch (rand() % 4) {
+        case 0:
+            xfree(alloc[r]);
+            if (xmem_find_block(alloc[r]) == alloc[r])
+                printf("Block %d still found after freeing it\n", r);
+            sz[r] = rand() % 512 + 1;
+            alloc[r] = xmalloc(sz[r], "Block %d", r);
+            break;
+        case 1:
+            sz[r] = rand() % 512 + 1;
+            alloc[r] = xrealloc(alloc[r], sz[r]);
+            break;
+        default:
+            off = rand() % sz[r];
+            check_any(alloc[r] + off);
+            checkr_any(alloc[r] + off, sz[r] - off);
+            if (xmem_find_block(alloc[r] + off) != alloc[r])
+                printf("Block %d not found at offset %d\n", r, off);
+        }
+    }
+
+    for (i = 0; i < ALLOCATIONS; i ++)
+        xfree(alloc[i]);
+
+    return 0;
+
+}
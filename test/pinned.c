@@ -0,0 +1,60 @@
+/**
+ * Copyright (c) 2014-2021, Ignacio Nin <nachex@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define ENABLE_LIBXMEM 1
+#include <libxmem.h>
+
+#define LENGTH 4096
+
+int
+main(int argc, char *argv[]) {
+    xmem_bounds_t b;
+    char *buffer;
+    int i, j;
+
+    buffer = xmalloc(LENGTH, "Pinned buffer");
+    b = xmem_pin(buffer);
+
+    for (j = 0; j < 1000; j ++) {
+        for (i = 0; i < LENGTH; i ++) {
+            check_pinned(buffer + i, b);
+            buffer[i] = i + j;
+        }
+        for (i = 0; i < LENGTH; i += 64)
+            checkr_pinned(buffer + i, 64, b);
+    }
+    checkr_pinned(buffer, LENGTH, b);
+
+    buffer = xrealloc(buffer, LENGTH * 2);
+    b = xmem_pin(buffer);
+    check_pinned(buffer + LENGTH * 2 - 1, b);
+
+    xfree(buffer);
+
+    return 0;
+
+}
@@ -0,0 +1,143 @@
+/**
+ * Copyright (c) 2014-2021, Ignacio Nin <nachex@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * An uninstrumented program, run again under libxmem-preload.so. Its leak
+ * report comes back through a pipe, with the caller addresses masked and
+ * the blocks sorted, since neither is predictable.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define PRELOAD "../src/.libs/libxmem-preload.so"
+#define MAXLINES 64
+
+// Where the compiler can't tell the leaks are never used
+char *leaked[3];
+
+static int
+compare(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+
+}
+
+static void
+mask(char *line) {
+    char *p, *end;
+
+    for (p = strstr(line, "0x"); p; p = strstr(p, "0x")) {
+        for (end = p + 2; *end && strchr("0123456789abcdef", *end); end ++)
+            ;
+        memmove(p + 3, end, strlen(end) + 1);
+        p[2] = '?';
+        p += 3;
+    }
+
+}
+
+static int
+supervise(char *argv[]) {
+    char buf[256], *lines[MAXLINES];
+    int fds[2], status, n = 0, i;
+    FILE *report;
+    pid_t pid;
+
+    if (pipe(fds) < 0) {
+        perror("pipe");
+        return 1;
+    }
+
+    pid = fork();
+    if (!pid) {
+        dup2(fds[1], 2);
+        close(fds[0]);
+        setenv("LD_PRELOAD", PRELOAD, 1);
+        execv("/proc/self/exe", argv);
+        perror("execv");
+        _exit(1);
+    }
+
+    close(fds[1]);
+    report = fdopen(fds[0], "r");
+    while (fgets(buf, sizeof(buf), report)) {
+        mask(buf);
+        if (!strncmp(buf, "- ", 2) && n < MAXLINES)
+            lines[n++] = strdup(buf);
+        else
+            fputs(buf, stdout);
+    }
+    fclose(report);
+
+    qsort(lines, n, sizeof(char *), compare);
+    for (i = 0; i < n; i ++) {
+        fputs(lines[i], stdout);
+        free(lines[i]);
+    }
+
+    waitpid(pid, &status, 0);
+
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+
+}
+
+int
+main(int argc, char *argv[]) {
+    char *b;
+    void *d;
+    int i, zero = 1;
+
+    if (!getenv("LD_PRELOAD"))
+        return supervise(argv);
+
+    // A buffer would be one more leak
+    setvbuf(stdout, NULL, _IONBF, 0);
+
+    leaked[0] = malloc(100);
+
+    b = calloc(10, 10);
+    for (i = 0; i < 100; i ++)
+        zero = zero && !b[i];
+    printf("calloc zeroed: %s\n", zero ? "yes" : "no");
+    free(b);
+
+    leaked[1] = realloc(NULL, 50);
+    leaked[1] = realloc(leaked[1], 5000);
+
+    printf("posix_memalign: %d, ", posix_memalign(&d, 64, 200));
+    printf("aligned: %s\n", (uintptr_t)d % 64 ? "no" : "yes");
+    free(d);
+
+    leaked[2] = strdup("A leaked string");
+
+    return 0;
+
+}
@@ -0,0 +1,98 @@
+/**
+ * Copyright (c) 2014-2021, Ignacio Nin <nachex@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * An uninstrumented program, run again under libxmem-preload.so with a
+ * binary log, that keeps allocating after a fork.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define PRELOAD "../src/.libs/libxmem-preload.so"
+#define LOG "preload_fork.bin"
+#define ROUNDS 10000
+
+// Where the compiler can't pair the allocations up and drop them
+void *volatile block;
+
+/**
+ * The child has no writer thread to drain its ring, and must neither wait
+ * for one nor write to the parent's log.
+ */
+static void
+churn(void) {
+    int i;
+
+    for (i = 0; i < ROUNDS; i ++) {
+        block = malloc(16);
+        free(block);
+    }
+
+}
+
+int
+main(int argc, char *argv[]) {
+    int status;
+    pid_t pid;
+
+    if (!getenv("LD_PRELOAD")) {
+        setenv("LD_PRELOAD", PRELOAD, 1);
+        setenv("XMEM_OPTIONS", "binlog=" LOG, 1);
+        execv("/proc/self/exe", argv);
+        perror("execv");
+        return 1;
+    }
+
+    // A buffer would be a leak
+    setvbuf(stdout, NULL, _IONBF, 0);
+
+    churn();
+
+    pid = fork();
+    if (!pid) {
+        // Killed instead of hanging if it spins
+        alarm(10);
+        churn();
+        _exit(0);
+    }
+
+    waitpid(pid, &status, 0);
+    if (WIFEXITED(status))
+        printf("Child exited with %d\n", WEXITSTATUS(status));
+    else
+        printf("Child killed by signal %d\n", WTERMSIG(status));
+
+    churn();
+    printf("Log written: %s\n", access(LOG, F_OK) ? "no" : "yes");
+    unlink(LOG);
+
+    return 0;
+
+}
@@ -0,0 +1,90 @@
+/**
+ * Copyright (c) 2014-2021, Ignacio Nin <nachex@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define ENABLE_LIBXMEM 1
+#include <libxmem.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * Timings can't be compared against anything, so this only checks that
+ * every operation was counted. Only built with profiling.
+ */
+
+static int
+counted(const char *report, const char *op, const char *count) {
+    const char *line;
+
+    line = strstr(report, op);
+    if (!line)
+        return 0;
+    line ++;
+
+    return !strncmp(line + strspn(line, "abcdefghijklmnopqrstuvwxyz "),
+            count, strlen(count));
+
+}
+
+int
+main(int argc, char *argv[]) {
+    char *report, *blocks[100];
+    size_t len;
+    FILE *out;
+    int i;
+
+    for (i = 0; i < 100; i ++)
+        blocks[i] = xmalloc(16, "Block %d", i);
+    for (i = 0; i < 100; i ++)
+        check(blocks[i] + 8, blocks[i]);
+    for (i = 0; i < 100; i ++)
+        blocks[i] = xrealloc(blocks[i], 32);
+    for (i = 0; i < 100; i ++)
+        xfree(blocks[i]);
+
+    out = open_memstream(&report, &len);
+    if (!xmem_profile_report(out)) {
+        fclose(out);
+        printf("No profile report\n");
+        return 1;
+    }
+    fclose(out);
+
+    if (!counted(report, "\nmalloc ", "100 ") ||
+            !counted(report, "\nrealloc ", "100 ") ||
+            !counted(report, "\nfree ", "100 ") ||
+            !counted(report, "\ncheck ", "100 ")) {
+        printf("Unexpected report:\n%s", report);
+        return 1;
+    }
+
+    free(report);
+
+    return 0;
+
+}
+
@@ -0,0 +1,97 @@
+/**
+ * Copyright (c) 2014-2021, Ignacio Nin <nachex@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define ENABLE_LIBXMEM 1
+#include <libxmem.h>
+#include <stdio.h>
+
+#define RATE 4096
+#define BLOCKS 100000
+#define LARGE 10000
+
+static void *blocks[BLOCKS];
+
+/**
+ * Estimates are random, so they're only checked to be close enough.
+ */
+static const char *
+close_to(double estimate, double real) {
+    return estimate >= real * 0.85 && estimate <= real * 1.15 ? "close" : "off";
+
+}
+
+static void
+print_estimate(const char *when, size_t bytes, unsigned long count) {
+    struct xmem_stats stats;
+
+    xmem_stats_snapshot(&stats);
+    printf("%s: bytes %s, blocks %s\n", when,
+            close_to(stats.live_bytes, bytes),
+            close_to(stats.live_blocks, count));
+
+}
+
+int
+main(int argc, char *argv[]) {
+    int i;
+
+    printf("Sampling set: %d\n", xmem_set_sampling(RATE));
+
+    for (i = 0; i < BLOCKS; i ++)
+        blocks[i] = xmalloc(64, "Block %d", i);
+    print_estimate("Allocated", BLOCKS * 64, BLOCKS);
+
+    for (i = 0; i < BLOCKS; i += 2)
+        xfree(blocks[i]);
+    print_estimate("Half freed", BLOCKS / 2 * 64, BLOCKS / 2);
+
+    for (i = 1; i < BLOCKS; i += 2)
+        blocks[i] = xrealloc(blocks[i], 256);
+    print_estimate("Reallocated", BLOCKS / 2 * 256, BLOCKS / 2);
+
+    for (i = 1; i < BLOCKS; i += 2)
+        xfree(blocks[i]);
+    print_estimate("All freed", 0, 0);
+
+    // Weights are far from whole numbers for blocks about the rate
+    for (i = 0; i < LARGE; i ++)
+        blocks[i] = xmalloc(RATE, "Large block %d", i);
+    print_estimate("Allocated at the rate", (size_t)LARGE * RATE, LARGE);
+
+    for (i = 0; i < LARGE; i ++)
+        xfree(blocks[i]);
+
+    printf("Sampling set again: %d\n", xmem_set_sampling(RATE));
+    // Before the report on stderr
+    fflush(stdout);
+
+    // Blocks this large are always sampled, with a weight of 1
+    xmalloc(1 << 20, "Forgotten");
+
+    return 0;
+
+}
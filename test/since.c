@@ -0,0 +1,71 @@
+/**
+ * Copyright (c) 2014-2021, Ignacio Nin <nachex@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define ENABLE_LIBXMEM 1
+#include <libxmem.h>
+#include <stdio.h>
+
+int
+main(int argc, char *argv[]) {
+    char *before[3], *after[3], *leak;
+    unsigned mark;
+    int i;
+
+    for (i = 0; i < 3; i ++)
+        before[i] = xmalloc(10, "Before %d", i);
+
+    mark = xmem_mark();
+    printf("Mark %u, %d blocks since\n", mark, xmem_report_since(mark));
+
+    for (i = 0; i < 3; i ++)
+        after[i] = xmalloc(20, "After %d", i);
+    before[0] = xrealloc(before[0], 30);
+    xfree(after[1]);
+    leak = xstrdup("Leaked");
+
+    fflush(stdout);
+    printf("%d blocks since mark %u\n", xmem_report_since(mark), mark);
+
+    fflush(stdout);
+    xmem_group_leaks(0);
+    printf("%d blocks since mark 0\n", xmem_report_since(0));
+
+    mark = xmem_mark();
+    xfree(leak);
+    leak = xstrdup("Leaked again");
+    fflush(stdout);
+    printf("%d blocks since mark %u\n", xmem_report_since(mark), mark);
+
+    for (i = 0; i < 3; i ++)
+        xfree(before[i]);
+    xfree(after[0]);
+    xfree(after[2]);
+    xfree(leak);
+
+    return 0;
+
+}
@@ -0,0 +1,141 @@
+/**
+ * Copyright (c) 2014-2021, Ignacio Nin <nachex@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define ENABLE_LIBXMEM 1
+#include <libxmem.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#define THREADS 4
+#define ROUNDS 5000
+
+static int thread_line;
+
+static void *
+worker(void *arg) {
+    int i;
+
+    for (i = 0; i < ROUNDS; i ++) {
+        thread_line = __LINE__ + 1;
+        void *p = xmalloc(16, "Thread block");
+        xfree(p);
+    }
+
+    return NULL;
+
+}
+
+static struct xmem_site_stats sites[8];
+static int nsites;
+
+static int
+collect_site(const struct xmem_site_stats *stats, void *arg) {
+    if (!strcmp(stats->file, __FILE__))
+        sites[nsites++] = *stats;
+
+    return 0;
+
+}
+
+static int
+compare_sites(const void *a, const void *b) {
+    return ((const struct xmem_site_stats *)a)->line -
+        ((const struct xmem_site_stats *)b)->line;
+
+}
+
+/**
+ * Sites are walked in no particular order.
+ */
+static void
+print_sites(void) {
+    struct xmem_site_stats *s;
+
+    nsites = 0;
+    xmem_site_stats(collect_site, NULL);
+    qsort(sites, nsites, sizeof(struct xmem_site_stats), compare_sites);
+
+    for (s = sites; s < sites + nsites; s ++) {
+        printf("line %d: %lu allocs, %lu frees, %lu live blocks, "
+                "%lu live bytes", s->line, s->allocs, s->frees,
+                s->live_blocks, (unsigned long)s->live_bytes);
+        // How far apart threads happened to run can't be predicted
+        if (s->line != thread_line)
+            printf(", %lu peak, %lu total", (unsigned long)s->peak_bytes,
+                    (unsigned long)s->total_bytes);
+        printf("\n");
+    }
+
+}
+
+static int
+stop_early(const struct xmem_site_stats *stats, void *arg) {
+    return 42;
+
+}
+
+int
+main(int argc, char *argv[]) {
+    pthread_t threads[THREADS];
+    char *blocks[1000], *small[10];
+    size_t i;
+
+    xmem_set_reentrant();
+
+    for (i = 0; i < 1000; i ++)
+        blocks[i] = xmalloc(100, "Block %lu", i);
+    for (i = 0; i < 600; i ++)
+        xfree(blocks[i]);
+
+    for (i = 0; i < 10; i ++)
+        small[i] = xmalloc(10, "Small block %lu", i);
+    for (i = 0; i < 10; i ++)
+        small[i] = xrealloc(small[i], 50);
+
+    for (i = 0; i < THREADS; i ++)
+        pthread_create(&threads[i], NULL, worker, NULL);
+    for (i = 0; i < THREADS; i ++)
+        pthread_join(threads[i], NULL);
+
+    print_sites();
+
+    for (i = 600; i < 1000; i ++)
+        xfree(blocks[i]);
+    for (i = 0; i < 10; i ++)
+        xfree(small[i]);
+
+    printf("After freeing:\n");
+    print_sites();
+
+    printf("Stopped with %d\n", xmem_site_stats(stop_early, NULL));
+
+    return 0;
+
+}
+
@@ -0,0 +1,111 @@
+/**
+ * Copyright (c) 2014-2021, Ignacio Nin <nachex@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define ENABLE_LIBXMEM 1
+#include <libxmem.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#define BLOCKS 300
+#define SIZE 1000
+
+static void *blocks[BLOCKS];
+static pthread_barrier_t freed, done;
+static int alloc_line;
+
+static void *
+consumer(void *arg) {
+    int i;
+
+    for (i = 0; i < BLOCKS; i ++)
+        xfree(blocks[i]);
+
+    return NULL;
+
+}
+
+/**
+ * Stays around until the stats are read, so what it has pending isn't
+ * flushed on exit.
+ */
+static void *
+producer(void *arg) {
+    pthread_t t;
+    int i;
+
+    for (i = 0; i < BLOCKS; i ++) {
+        alloc_line = __LINE__ + 1;
+        blocks[i] = xmalloc(SIZE, "Block %d", i);
+    }
+
+    pthread_create(&t, NULL, consumer, NULL);
+    pthread_join(t, NULL);
+
+    pthread_barrier_wait(&freed);
+    pthread_barrier_wait(&done);
+
+    return NULL;
+
+}
+
+static int
+print_site(const struct xmem_site_stats *s, void *arg) {
+    if (strcmp(s->file, __FILE__) || s->line != alloc_line)
+        return 0;
+
+    printf("%lu allocs, %lu frees, %lu live blocks, %lu live bytes, "
+            "%lu peak\n", s->allocs, s->frees, s->live_blocks,
+            (unsigned long)s->live_bytes, (unsigned long)s->peak_bytes);
+
+    return 0;
+
+}
+
+int
+main(int argc, char *argv[]) {
+    pthread_t t;
+
+    xmem_set_reentrant();
+
+    pthread_barrier_init(&freed, NULL, 2);
+    pthread_barrier_init(&done, NULL, 2);
+    pthread_create(&t, NULL, producer, NULL);
+
+    pthread_barrier_wait(&freed);
+    printf("Allocating thread running:\n");
+    xmem_site_stats(print_site, NULL);
+    pthread_barrier_wait(&done);
+
+    pthread_join(t, NULL);
+    printf("Allocating thread gone:\n");
+    xmem_site_stats(print_site, NULL);
+
+    return 0;
+
+}
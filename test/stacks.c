@@ -0,0 +1,123 @@
+/**
+ * Copyright (c) 2014-2021, Ignacio Nin <nachex@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define ENABLE_LIBXMEM 1
+#include <libxmem.h>
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * Every block comes from the same line in wrapper(), but from two different
+ * callers, so two stacks.
+ */
+
+#define noinline __attribute__ (( noinline ))
+
+static void *blocks[4];
+
+// Not a constant, or the loop below could be unrolled into three calls
+int rounds = 3;
+
+noinline void *
+wrapper(size_t sz) {
+    void *ret = xmalloc(sz, "Wrapped");
+
+    // Keeps the call from being a tail call, which would hide this frame
+    __asm__ volatile ("" ::: "memory");
+
+    return ret;
+
+}
+
+noinline void
+first(void) {
+    int i;
+
+    for (i = 0; i < rounds; i ++)
+        blocks[i] = wrapper(100);
+
+}
+
+noinline void
+second(void) {
+    blocks[3] = wrapper(50);
+
+}
+
+static int
+print_stack(const struct xmem_stack_stats *stats, void *arg) {
+    char *buf, *first_frame, *second_frame;
+    size_t len;
+    FILE *out;
+
+    out = open_memstream(&buf, &len);
+    xmem_print_stack(out, stats->id);
+    fclose(out);
+
+    // Symbols may come with offsets and addresses, which vary
+    first_frame = strtok(buf, "\n");
+    second_frame = strtok(NULL, "\n");
+    printf("%lu blocks, %lu bytes: from %s, called by %s\n", stats->blocks,
+            (unsigned long)stats->bytes,
+            first_frame && strstr(first_frame, "wrapper") ? "wrapper" : "?",
+            !second_frame ? "?" : strstr(second_frame, "first") ? "first" :
+                strstr(second_frame, "second") ? "second" : "?");
+    free(buf);
+
+    return 0;
+
+}
+
+int
+main(int argc, char *argv[]) {
+    int i;
+
+    xmem_enable_stacks();
+
+    first();
+    second();
+    xmem_stack_stats(print_stack, NULL);
+
+    xfree(blocks[1]);
+    printf("One freed\n");
+    xmem_stack_stats(print_stack, NULL);
+
+    for (i = 0; i < 4; i ++)
+        if (i != 1)
+            xfree(blocks[i]);
+    printf("All freed\n");
+    xmem_stack_stats(print_stack, NULL);
+
+    printf("Depth 0: %d, depth 1: %d\n", xmem_set_stack_depth(0),
+            xmem_set_stack_depth(1));
+    second();
+    xmem_stack_stats(print_stack, NULL);
+    xfree(blocks[3]);
+
+    return 0;
+
+}
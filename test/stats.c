@@ -0,0 +1,100 @@
+/**
+ * Copyright (c) 2014-2021, Ignacio Nin <nachex@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define ENABLE_LIBXMEM 1
+#include <libxmem.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#define THREADS 4
+#define ROUNDS 10000
+
+static void *
+worker(void *arg) {
+    void *blocks[4];
+    int i, j;
+
+    for (i = 0; i < ROUNDS; i ++) {
+        for (j = 0; j < 4; j ++)
+            blocks[j] = xmalloc(8, "Thread block");
+        for (j = 0; j < 4; j ++)
+            xfree(blocks[j]);
+    }
+
+    return NULL;
+
+}
+
+static void
+print_stats(const char *when, int peak) {
+    struct xmem_stats stats;
+
+    xmem_stats_snapshot(&stats);
+    printf("%s: %lu live bytes in %lu blocks, ", when,
+            (unsigned long)stats.live_bytes, stats.live_blocks);
+    if (peak)
+        printf("%lu peak, ", (unsigned long)stats.peak_bytes);
+    printf("%lu allocs, %lu frees\n", stats.allocs, stats.frees);
+
+}
+
+int
+main(int argc, char *argv[]) {
+    pthread_t threads[THREADS];
+    char *a, *b, *c;
+    int i;
+
+    print_stats("Start", 1);
+
+    a = xmalloc(1000, "First");
+    b = xmalloc(500, "Second");
+    xfree(a);
+    print_stats("Two allocated, one freed", 1);
+
+    b = xrealloc(b, 2000);
+    print_stats("Reallocated", 1);
+
+    xmem_reset_peak();
+    print_stats("Peak reset", 1);
+
+    c = xstrdup("twelve bytes");
+    xfree(c);
+    print_stats("Request", 1);
+
+    xmem_set_reentrant();
+    for (i = 0; i < THREADS; i ++)
+        pthread_create(&threads[i], NULL, worker, NULL);
+    for (i = 0; i < THREADS; i ++)
+        pthread_join(threads[i], NULL);
+    xfree(b);
+    // How much the threads overlapped can't be predicted
+    print_stats("Threads", 0);
+
+    return 0;
+
+}
+
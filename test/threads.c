@@ -0,0 +1,76 @@
+/**
+ * Copyright (c) 2014-2021, Ignacio Nin <nachex@gmail.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define ENABLE_LIBXMEM 1
+#include <libxmem.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#define THREADS 8
+#define ALLOCATIONS 1024
+#define ROUNDS 200
+
+static void *
+worker(void *arg) {
+    void *alloc[ALLOCATIONS];
+    unsigned seed = (size_t)arg;
+    int i, j;
+
+    for (j = 0; j < ROUNDS; j ++) {
+        for (i = 0; i < ALLOCATIONS; i ++)
+            alloc[i] = xmalloc(rand_r(&seed) % 256 + 1, "Thread %lu block %d",
+                    (size_t)arg, i);
+        for (i = 0; i < ALLOCATIONS; i ++) {
+            check(alloc[i], alloc[i]);
+            xfree(alloc[i]);
+        }
+    }
+
+    return NULL;
+
+}
+
+int
+main(int argc, char *argv[]) {
+    pthread_t threads[THREADS];
+    size_t i;
+
+    xmem_set_reentrant();
+    if (!xmem_set_shards(THREADS * 4)) {
+        fprintf(stderr, "Could not set shards\n");
+        return 1;
+    }
+
+    for (i = 0; i < THREADS; i ++)
+        pthread_create(&threads[i], NULL, worker, (void *)i);
+    for (i = 0; i < THREADS; i ++)
+        pthread_join(threads[i], NULL);
+
+    return 0;
+
+}